@@ -0,0 +1,268 @@
+/**
+ * @file BatchSource.h
+ * @brief Header file for the BatchSource interface in the FlexNN neural network library.
+ *
+ * This file defines the BatchSource interface, which hands out the samples of a dataset one
+ * mini-batch at a time. Training and evaluation read from it into buffers they allocate once, so
+ * the dataset behind it can be stored in any form (compact integers, a memory-mapped file, a view
+ * of a matrix) without ever being converted as a whole. It also defines MatrixBatchSource, a view
+ * of some samples of a matrix that is already in memory, and CSVStreamSource, which streams a CSV
+ * file of any size through a fixed-size buffer.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_BatchSource_H
+#define FlexNN_BatchSource_H
+
+#include <cstddef>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "Utility.h"
+
+/**
+ * @namespace FlexNN
+ * @brief Namespace for the FlexNN neural network library.
+ *
+ * This namespace contains all the classes and functions related to the FlexNN library,
+ * including the NeuralNetwork class and Layer class. It provides a structured way to organize
+ * the library's components and avoid naming conflicts with other libraries.
+ */
+namespace FlexNN
+{
+  /**
+   * @class BatchSource
+   * @brief Interface of a dataset that is read one mini-batch at a time.
+   *
+   * A pass over the data (an epoch) starts with reset() and then calls read() until it returns 0.
+   * Every call converts the next samples into the caller's buffers, in the (features, samples)
+   * layout the network expects, together with their integer class labels.
+   *
+   * @tparam Scalar The floating point type the features are converted to (float or double).
+   */
+  template <typename Scalar>
+  class BatchSource
+  {
+  public:
+    /**
+     * @brief Matrix type of the feature buffers.
+     */
+    typedef Eigen::MatrixX<Scalar> Matrix;
+
+    virtual ~BatchSource() {}
+
+    /**
+     * @brief Get the number of features of each sample.
+     *
+     * @return long The number of rows read() writes to.
+     */
+    virtual long getFeatureCount() const = 0;
+
+    /**
+     * @brief Start a new pass over the samples.
+     *
+     * @param shuffle Whether to visit the samples in a new random order.
+     */
+    virtual void reset(bool shuffle) = 0;
+
+    /**
+     * @brief Read the next samples of the current pass.
+     *
+     * @param X The buffer to store the features in, one column per sample. At most X.cols() samples are read.
+     * @param Y The buffer to store the class labels in, with at least X.cols() entries.
+     * @return int The number of samples read into the leading columns of X, or 0 at the end of the pass.
+     */
+    virtual int read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y) = 0;
+  };
+
+  /**
+   * @class MatrixBatchSource
+   * @brief A BatchSource reading some samples of a feature matrix and label vector, without copying them.
+   *
+   * The source only owns a list of sample indices; the features and labels stay in the matrices
+   * it was built from, which must outlive it. Samples are gathered into the caller's buffer when
+   * a batch is read. This makes splits of a dataset (see splitXYView) cost no memory beyond
+   * their indices, and the indices of several views can be combined, e.g. for k-fold validation.
+   *
+   * @tparam Scalar The floating point type of the features (float or double).
+   */
+  template <typename Scalar>
+  class MatrixBatchSource : public BatchSource<Scalar>
+  {
+  public:
+    /**
+     * @brief Matrix type of the features and feature buffers.
+     */
+    typedef typename BatchSource<Scalar>::Matrix Matrix;
+    /**
+     * @brief Vector type of the labels.
+     */
+    typedef Eigen::VectorX<Scalar> Vector;
+
+    /**
+     * @brief Constructor for the MatrixBatchSource class.
+     *
+     * @param X The features, which must outlive the source.
+     * @param Y The labels, one per sample, which must outlive the source.
+     * @param indices The indices of the samples to read, in the order they are read until the first shuffle.
+     * @param layout The layout of X.
+     * @throws std::out_of_range If an index is not a sample of X and Y.
+     */
+    MatrixBatchSource(const Matrix &X, const Vector &Y, const std::vector<long> &indices, DataLayout layout = DataLayout::SamplesByFeatures);
+
+    /**
+     * @brief Get the number of samples the source reads in a pass.
+     *
+     * @return long The number of samples.
+     */
+    long getSampleCount() const { return indices.size(); }
+
+    /**
+     * @brief Get the indices of the samples the source reads.
+     *
+     * @return The indices, in the order of the current pass.
+     */
+    const std::vector<long> &getIndices() const { return indices; }
+
+    long getFeatureCount() const override { return layout == DataLayout::FeaturesBySamples ? features->rows() : features->cols(); }
+
+    void reset(bool shuffle) override;
+
+    int read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y) override;
+
+  private:
+    /**
+     * @brief The features the samples are read from.
+     */
+    const Matrix *features;
+    /**
+     * @brief The labels the samples are read from.
+     */
+    const Vector *labels;
+    /**
+     * @brief Indices of the samples, in the order of the current pass.
+     */
+    std::vector<long> indices;
+    /**
+     * @brief The layout of the features.
+     */
+    DataLayout layout;
+    /**
+     * @brief Position of the next sample to read in indices.
+     */
+    size_t position;
+    /**
+     * @brief Random number generator used to shuffle the samples.
+     */
+    std::mt19937 rng;
+  };
+
+  /**
+   * @class CSVStreamSource
+   * @brief A BatchSource streaming the rows of a CSV file, with bounded memory.
+   *
+   * The file has the format read by readCSV_XY() (a header line, then the label and the features
+   * of one sample per row). It is read sequentially through a buffer of fixed size, which only
+   * grows if a single row does not fit in it, so files far larger than the memory of the machine
+   * can be trained on. Every pass reads the file again from the start.
+   *
+   * Rows are read in file order: a stream cannot be shuffled, so `shuffle` is ignored by reset().
+   * Shuffle the file once beforehand, or convert it to a dataset file and use a
+   * DatasetStreamSource, which shuffles within bounded memory.
+   *
+   * @tparam Scalar The floating point type the features are converted to (float or double).
+   */
+  template <typename Scalar>
+  class CSVStreamSource : public BatchSource<Scalar>
+  {
+  public:
+    /**
+     * @brief Matrix type of the feature buffers.
+     */
+    typedef typename BatchSource<Scalar>::Matrix Matrix;
+
+    /**
+     * @brief Constructor for the CSVStreamSource class.
+     *
+     * Opens the file and reads its first row to find the number of features.
+     *
+     * @param filename The path to the CSV file to read.
+     * @param scale The factor every feature is multiplied by.
+     * @param bufferSize The size of the read buffer in bytes.
+     * @throws std::runtime_error If the file cannot be opened or has no data rows.
+     */
+    explicit CSVStreamSource(const std::string &filename, Scalar scale = Scalar(1), size_t bufferSize = 1 << 20);
+
+    long getFeatureCount() const override { return features; }
+
+    void reset(bool shuffle) override;
+
+    /**
+     * @brief Read the next rows of the file.
+     *
+     * @param X The buffer to store the features in, one column per sample. At most X.cols() samples are read.
+     * @param Y The buffer to store the class labels in, with at least X.cols() entries.
+     * @return int The number of samples read into the leading columns of X, or 0 at the end of the file.
+     * @throws std::invalid_argument If a stored label is not a finite value in the range of int.
+     * @throws std::runtime_error If a row is malformed.
+     */
+    int read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y) override;
+
+  private:
+    /**
+     * @brief Move to the start of the first data row of the file.
+     */
+    void rewind();
+
+    /**
+     * @brief Get the next line of the file, refilling the buffer as needed.
+     *
+     * @param line Receives the start of the line.
+     * @param stop Receives the end of the line (without the newline).
+     * @return Whether there was a line left.
+     */
+    bool nextLine(const char *&line, const char *&stop);
+
+    /**
+     * @brief The path to the file, for error messages.
+     */
+    std::string filename;
+    /**
+     * @brief The file being read.
+     */
+    std::ifstream file;
+    /**
+     * @brief Factor every feature is multiplied by.
+     */
+    Scalar scale;
+    /**
+     * @brief Number of features of each sample.
+     */
+    long features;
+    /**
+     * @brief Number of data rows read in the current pass, for error messages.
+     */
+    long row;
+    /**
+     * @brief Read buffer.
+     */
+    std::vector<char> buffer;
+    /**
+     * @brief Start of the unread bytes in the buffer.
+     */
+    size_t begin;
+    /**
+     * @brief End of the valid bytes in the buffer.
+     */
+    size_t end;
+    /**
+     * @brief Whether the whole file has been read into the buffer.
+     */
+    bool eof;
+  };
+}
+
+#endif // FlexNN_BatchSource_H
@@ -0,0 +1,456 @@
+/**
+ * @file Dataset.h
+ * @brief Header file for the Dataset class in the FlexNN neural network library.
+ *
+ * This file defines the binary dataset format of the library and the Dataset class that reads it.
+ * A dataset file holds a small header with the shape and element types of the data, followed by the
+ * features in the (features, samples) layout the network expects and the labels, each aligned to a
+ * cache line. Loading a dataset maps the file into memory and hands out Eigen views of it, so a
+ * dataset converted once from CSV can be reopened in milliseconds. Features can also be stored as
+ * compact integers with a scale factor, and converted to floating point one mini-batch at a time
+ * by a DatasetBatchSource, or by a DatasetStreamSource for files larger than memory.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_Dataset_H
+#define FlexNN_Dataset_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "BatchSource.h"
+#include "MappedFile.h"
+
+/**
+ * @namespace FlexNN
+ * @brief Namespace for the FlexNN neural network library.
+ *
+ * This namespace contains all the classes and functions related to the FlexNN library,
+ * including the NeuralNetwork class and Layer class. It provides a structured way to organize
+ * the library's components and avoid naming conflicts with other libraries.
+ */
+namespace FlexNN
+{
+  /**
+   * @enum DataType
+   * @brief Element types of the arrays stored in a dataset file.
+   */
+  enum class DataType : uint32_t
+  {
+    Float32 = 1, ///< 4 byte IEEE 754 floating point, read as float.
+    Float64 = 2, ///< 8 byte IEEE 754 floating point, read as double.
+    UInt8 = 3,   ///< 1 byte unsigned integer, read as uint8_t.
+    UInt16 = 4,  ///< 2 byte unsigned integer, read as uint16_t.
+    Int32 = 5    ///< 4 byte signed integer, read as int32_t (labels only).
+  };
+
+  /**
+   * @class Dataset
+   * @brief A read-only dataset memory-mapped from a binary dataset file.
+   *
+   * The file starts with a 64 byte header (magic "FLEXNNDS", format version, element types of the
+   * features and labels, number of samples and features, the offsets of the two arrays and the
+   * feature scale), followed by the features as a column-major (features, samples) matrix and the
+   * labels as a vector. Both arrays start on a 64 byte boundary. Numbers are stored in the byte
+   * order of the machine that wrote the file.
+   *
+   * Integer features are stored raw, and the feature scale is the factor that turns them into the
+   * values the network is trained on (1/255 for 8-bit pixels), so a dataset of bytes takes an eighth
+   * of the memory of the same dataset as doubles. gather() applies the scale while copying samples
+   * into a floating point batch.
+   *
+   * The accessors return Eigen::Map views straight into the mapping, nothing is copied. The mapping
+   * is shared by all copies of a Dataset and released with the last one, so the views stay valid as
+   * long as one of them is alive.
+   *
+   * A Dataset can also be a view of files in other binary formats whose arrays can be used as they
+   * are stored, such as the MNIST IDX files opened by readIDX(). The features and labels may then
+   * come from two separate mappings.
+   */
+  class Dataset
+  {
+  public:
+    /**
+     * @brief Open a dataset file.
+     *
+     * @param filename The path to the dataset file.
+     * @throws std::runtime_error If the file cannot be mapped or is not a valid dataset file.
+     */
+    explicit Dataset(const std::string &filename);
+
+    /**
+     * @brief Write features and labels to a dataset file.
+     *
+     * The file is written under a temporary name and renamed over the target once it is complete,
+     * so an interrupted conversion never leaves a truncated dataset file behind.
+     *
+     * @param filename The path to the dataset file to create (or overwrite).
+     * @param X The features, in the form (features, samples).
+     * @param Y The labels, one per sample.
+     * @param scale The feature scale recorded in the header, the factor gather() multiplies the features by.
+     * @throws std::invalid_argument If X and Y do not have the same number of samples.
+     * @throws std::runtime_error If the file cannot be written.
+     *
+     * @tparam Feature The type to store the features as (float, double, uint8_t or uint16_t).
+     * @tparam Label The type to store the labels as (the same floating point type, or int32_t).
+     */
+    template <typename Feature, typename Label>
+    static void write(const std::string &filename, const Eigen::MatrixX<Feature> &X, const Eigen::VectorX<Label> &Y, double scale = 1.0);
+
+    /**
+     * @brief Convert a CSV file to a dataset file.
+     *
+     * The CSV file is read like readCSV_XY() does (labels in the first column, a header line that
+     * is skipped), but streamed in chunks that are written out as they are read, so files far larger
+     * than the memory of the machine can be converted. The labels are read as integer classes.
+     * Floating point features are multiplied by `scale` before they are stored and keep labels of the
+     * same floating point type. Integer features are stored as they are in the file, with `scale`
+     * recorded as the feature scale and the labels stored as int32_t.
+     *
+     * @param csvFilename The path to the CSV file to read.
+     * @param filename The path to the dataset file to create (or overwrite).
+     * @param featureType The type to store the features as.
+     * @param scale The factor every feature is multiplied by.
+     * @throws std::invalid_argument If featureType is Int32, which is only used for labels.
+     * @throws std::runtime_error If a file cannot be read or written, a row is malformed, or a
+     * value does not fit the integer feature type.
+     */
+    static void fromCSV(const std::string &csvFilename, const std::string &filename,
+                        DataType featureType = DataType::Float64, double scale = 1.0);
+
+    /**
+     * @brief Get the number of samples in the dataset.
+     *
+     * @return long The number of samples.
+     */
+    long getSampleCount() const { return samples; }
+
+    /**
+     * @brief Get the number of features of each sample.
+     *
+     * @return long The number of features.
+     */
+    long getFeatureCount() const { return featureCount; }
+
+    /**
+     * @brief Get the element type of the features.
+     *
+     * @return DataType The type the features are stored as.
+     */
+    DataType getFeatureType() const { return featureType; }
+
+    /**
+     * @brief Get the element type of the labels.
+     *
+     * @return DataType The type the labels are stored as.
+     */
+    DataType getLabelType() const { return labelType; }
+
+    /**
+     * @brief Get the feature scale.
+     *
+     * @return double The factor gather() multiplies the stored features by.
+     */
+    double getFeatureScale() const { return featureScale; }
+
+    /**
+     * @brief Get a view of the features as they are stored.
+     *
+     * @return A (features, samples) view of the features, pointing into the mapping.
+     * @throws std::runtime_error If the features are not stored as T.
+     *
+     * @tparam T The type the features are stored as (float, double, uint8_t or uint16_t).
+     */
+    template <typename T>
+    Eigen::Map<const Eigen::MatrixX<T>> features() const;
+
+    /**
+     * @brief Get a view of the labels as they are stored.
+     *
+     * @return A view of the labels, one per sample, pointing into the mapping.
+     * @throws std::runtime_error If the labels are not stored as T.
+     *
+     * @tparam T The type the labels are stored as (float, double, uint8_t or int32_t).
+     */
+    template <typename T>
+    Eigen::Map<const Eigen::VectorX<T>> labels() const;
+
+    /**
+     * @brief Copy samples into a floating point batch.
+     *
+     * The features of each sample are converted to Scalar and multiplied by the feature scale,
+     * and its label is converted to an integer class.
+     *
+     * @param indices The indices of the samples to copy.
+     * @param count The number of samples to copy, at most X.cols().
+     * @param X The buffer to store the features in, one column per sample.
+     * @param Y The buffer to store the class labels in.
+     *
+     * @tparam Scalar The floating point type of the batch (float or double).
+     */
+    template <typename Scalar>
+    void gather(const long *indices, long count, Eigen::Ref<Eigen::MatrixX<Scalar>> X, Eigen::Ref<Eigen::VectorXi> Y) const;
+
+  private:
+    /**
+     * @brief Construct a view of arrays stored in memory-mapped files, for the readers of other formats.
+     *
+     * @param featureFile The mapping holding the features.
+     * @param featureData Start of the (features, samples) feature matrix in featureFile.
+     * @param featureType Element type of the features.
+     * @param featureCount Number of features of each sample.
+     * @param labelFile The mapping holding the labels, which may be featureFile.
+     * @param labelData Start of the label vector in labelFile.
+     * @param labelType Element type of the labels.
+     * @param samples Number of samples.
+     * @param featureScale Factor the stored features are multiplied by when they are gathered.
+     */
+    Dataset(std::shared_ptr<MappedFile> featureFile, const char *featureData, DataType featureType, long featureCount,
+            std::shared_ptr<MappedFile> labelFile, const char *labelData, DataType labelType, long samples, double featureScale);
+
+    friend Dataset readIDX(const std::string &imagesFilename, const std::string &labelsFilename, double scale);
+
+    /**
+     * @brief The mapping of the dataset file, shared by all copies of the dataset.
+     */
+    std::shared_ptr<MappedFile> file;
+    /**
+     * @brief The mapping holding the labels, if they are not stored in the same file as the features.
+     */
+    std::shared_ptr<MappedFile> labelFile;
+    /**
+     * @brief Number of samples.
+     */
+    long samples;
+    /**
+     * @brief Number of features of each sample.
+     */
+    long featureCount;
+    /**
+     * @brief Element type of the features.
+     */
+    DataType featureType;
+    /**
+     * @brief Element type of the labels.
+     */
+    DataType labelType;
+    /**
+     * @brief Factor the stored features are multiplied by when they are gathered.
+     */
+    double featureScale;
+    /**
+     * @brief Start of the features in the mapping.
+     */
+    const char *featureData;
+    /**
+     * @brief Start of the labels in the mapping.
+     */
+    const char *labelData;
+  };
+
+  /**
+   * @class DatasetBatchSource
+   * @brief A BatchSource reading the samples of a Dataset.
+   *
+   * The source visits a list of sample indices (all samples, or a subset such as the training
+   * part of a split) and gathers them batch by batch straight from the mapping, converting and
+   * scaling them into the caller's buffer. Only the indices are owned by the source.
+   *
+   * @tparam Scalar The floating point type the features are converted to (float or double).
+   */
+  template <typename Scalar>
+  class DatasetBatchSource : public BatchSource<Scalar>
+  {
+  public:
+    /**
+     * @brief Matrix type of the feature buffers.
+     */
+    typedef typename BatchSource<Scalar>::Matrix Matrix;
+
+    /**
+     * @brief Constructor for the DatasetBatchSource class, reading every sample of a dataset.
+     *
+     * @param dataset The dataset to read, which shares its mapping with the source.
+     */
+    explicit DatasetBatchSource(const Dataset &dataset);
+
+    /**
+     * @brief Constructor for the DatasetBatchSource class, reading some samples of a dataset.
+     *
+     * @param dataset The dataset to read, which shares its mapping with the source.
+     * @param indices The indices of the samples to read, in the order they are read until the first shuffle.
+     * @throws std::out_of_range If an index is not a sample of the dataset.
+     */
+    DatasetBatchSource(const Dataset &dataset, const std::vector<long> &indices);
+
+    /**
+     * @brief Get the number of samples the source reads in a pass.
+     *
+     * @return long The number of samples.
+     */
+    long getSampleCount() const { return indices.size(); }
+
+    long getFeatureCount() const override { return dataset.getFeatureCount(); }
+
+    void reset(bool shuffle) override;
+
+    int read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y) override;
+
+  private:
+    /**
+     * @brief The dataset the samples are read from.
+     */
+    Dataset dataset;
+    /**
+     * @brief Indices of the samples, in the order of the current pass.
+     */
+    std::vector<long> indices;
+    /**
+     * @brief Position of the next sample to read in indices.
+     */
+    size_t position;
+    /**
+     * @brief Random number generator used to shuffle the samples.
+     */
+    std::mt19937 rng;
+  };
+
+  /**
+   * @class DatasetStreamSource
+   * @brief A BatchSource streaming the samples of a dataset file in chunks, with bounded memory.
+   *
+   * Instead of mapping the whole file, the source reads it with ordinary file I/O one chunk of
+   * consecutive samples at a time, into buffers of a fixed size. Every chunk is read with two
+   * sequential reads (features and labels), so files far larger than the memory of the machine
+   * train at disk speed. When shuffling, the chunks are visited in a random order and the samples
+   * of each chunk in a random order too, which approximates a full shuffle within bounded memory.
+   *
+   * @tparam Scalar The floating point type the features are converted to (float or double).
+   */
+  template <typename Scalar>
+  class DatasetStreamSource : public BatchSource<Scalar>
+  {
+  public:
+    /**
+     * @brief Matrix type of the feature buffers.
+     */
+    typedef typename BatchSource<Scalar>::Matrix Matrix;
+
+    /**
+     * @brief Constructor for the DatasetStreamSource class.
+     *
+     * @param filename The path to the dataset file.
+     * @param chunkSamples The number of samples read from the file at once.
+     * @throws std::runtime_error If the file cannot be opened or is not a valid dataset file.
+     */
+    explicit DatasetStreamSource(const std::string &filename, long chunkSamples = 4096);
+
+    /**
+     * @brief Get the number of samples the source reads in a pass.
+     *
+     * @return long The number of samples.
+     */
+    long getSampleCount() const { return samples; }
+
+    long getFeatureCount() const override { return featureCount; }
+
+    void reset(bool shuffle) override;
+
+    /**
+     * @brief Read the next samples of the current pass.
+     *
+     * @param X The buffer to store the features in, one column per sample. At most X.cols() samples are read.
+     * @param Y The buffer to store the class labels in, with at least X.cols() entries.
+     * @return int The number of samples read into the leading columns of X, or 0 at the end of the pass.
+     * @throws std::invalid_argument If a stored label is not a finite value in the range of int.
+     * @throws std::runtime_error If the file cannot be read.
+     */
+    int read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y) override;
+
+  private:
+    /**
+     * @brief Read a chunk of samples into the buffers.
+     */
+    void loadChunk(long chunk);
+
+    /**
+     * @brief The path to the file, for error messages.
+     */
+    std::string filename;
+    /**
+     * @brief The file being read.
+     */
+    std::ifstream file;
+    /**
+     * @brief Number of samples.
+     */
+    long samples;
+    /**
+     * @brief Number of features of each sample.
+     */
+    long featureCount;
+    /**
+     * @brief Element type of the features.
+     */
+    DataType featureType;
+    /**
+     * @brief Element type of the labels.
+     */
+    DataType labelType;
+    /**
+     * @brief Factor the stored features are multiplied by when they are gathered.
+     */
+    double featureScale;
+    /**
+     * @brief Offset of the features in the file.
+     */
+    uint64_t featureOffset;
+    /**
+     * @brief Offset of the labels in the file.
+     */
+    uint64_t labelOffset;
+    /**
+     * @brief Number of samples in a chunk.
+     */
+    long chunkSamples;
+    /**
+     * @brief Order in which the chunks are visited in the current pass.
+     */
+    std::vector<long> chunkOrder;
+    /**
+     * @brief Position of the next chunk to load in chunkOrder.
+     */
+    size_t nextChunk;
+    /**
+     * @brief Features of the current chunk, as stored in the file.
+     */
+    std::vector<char> featureBuffer;
+    /**
+     * @brief Labels of the current chunk, as stored in the file.
+     */
+    std::vector<char> labelBuffer;
+    /**
+     * @brief Order in which the samples of the current chunk are read.
+     */
+    std::vector<long> chunkIndices;
+    /**
+     * @brief Position of the next sample to read in chunkIndices.
+     */
+    size_t position;
+    /**
+     * @brief Whether the current pass is shuffled.
+     */
+    bool shuffling;
+    /**
+     * @brief Random number generator used to shuffle the chunks and samples.
+     */
+    std::mt19937 rng;
+  };
+}
+
+#endif // FlexNN_Dataset_H
@@ -11,10 +11,16 @@
 #ifndef FlexNN_H
 #define FlexNN_H
 
+#include <algorithm>
+#include <functional>
+#include <string>
 #include <vector>
 #include <Eigen/Dense>
 
+#include "BatchSource.h"
 #include "Layer.h"
+#include "Optimizer.h"
+#include "Workspace.h"
 
 /**
  * @namespace FlexNN
@@ -26,6 +32,38 @@
  */
 namespace FlexNN
 {
+  /**
+   * @struct EpochStats
+   * @brief Metrics of one training epoch, handed to the epoch callback of a network.
+   *
+   * The loss and accuracy are those of the forward passes the epoch trained on, so they cost
+   * nothing extra; as the weights change after every mini-batch, they describe the network
+   * during the epoch rather than at its end.
+   */
+  struct EpochStats
+  {
+    int epoch;                 ///< Number of the epoch, starting at 1.
+    int epochs;                ///< Number of epochs of the training run.
+    long samples;              ///< Number of samples trained on in the epoch.
+    double loss;               ///< Mean loss over the samples of the epoch.
+    double accuracy;           ///< Fraction of the samples classified correctly by the pass that trained on them.
+    bool validated;            ///< Whether the validation set was evaluated after this epoch (and synchronously).
+    double validationAccuracy; ///< Accuracy on the validation samples, if validated.
+  };
+
+  /**
+   * @brief Function called at the end of every training epoch.
+   */
+  typedef std::function<void(const EpochStats &)> EpochCallback;
+
+  /**
+   * @brief Function called with the number of the epoch and the accuracy of every evaluation of the validation samples.
+   */
+  typedef std::function<void(int, double)> ValidationCallback;
+
+  template <typename Scalar>
+  class AsyncEvaluator;
+
   /**
    * @class NeuralNetwork
    * @brief Class representing a neural network.
@@ -33,29 +71,157 @@ namespace FlexNN
    * This class encapsulates the functionality of a neural network, including training,
    * prediction, and accuracy calculation. It uses a vector of Layer objects to represent
    * the structure of the network.
+   *
+   * The class is templated on the scalar type of its weights and activations; use the
+   * NeuralNetwork (double) and NeuralNetworkF (float) typedefs.
+   *
+   * Inference is const and reentrant: predict(), predictOne() and accuracy() only read the
+   * weights, and write to buffers that are either local to the call, provided by the caller or
+   * owned by the calling thread. Any number of threads can therefore serve predictions from one
+   * network without locking, as long as none of them trains it at the same time.
+   *
+   * @tparam Scalar The floating point type of the weights and activations (float or double).
    */
-  class NeuralNetwork
+  template <typename Scalar>
+  class BasicNeuralNetwork
   {
   public:
+    /**
+     * @brief Matrix type used for inputs, targets and outputs.
+     */
+    typedef Eigen::MatrixX<Scalar> Matrix;
+    /**
+     * @brief Vector type used for single samples.
+     */
+    typedef Eigen::VectorX<Scalar> Vector;
+
     /**
      * @brief Constructor for the NeuralNetwork class.
      *
      * @param layers A vector of Layer objects representing the layers of the neural network.
      */
-    NeuralNetwork(const std::vector<Layer> &layers) : layers(layers) {}
+    BasicNeuralNetwork(const std::vector<BasicLayer<Scalar>> &layers)
+        : layers(layers), validationSource(nullptr), validationInterval(1), validationSamples(0), validationAsync(false) {}
+
+    /**
+     * @brief Set the update rule used by training.
+     *
+     * The default is plain SGD. The optimizer state (velocities, moment estimates) is kept by
+     * every layer and carries over between calls to train(); it starts over when the update rule
+     * changes.
+     *
+     * @param optimizer The update rule and its hyperparameters, e.g. Optimizer::adam().
+     */
+    void setOptimizer(const Optimizer &optimizer) { this->optimizer = optimizer; }
+
+    /**
+     * @brief Set the function called with the metrics of every training epoch.
+     *
+     * Training does not log anything by itself; install a callback to print or record progress.
+     *
+     * @param callback The function to call, or an empty function to stop reporting.
+     */
+    void setEpochCallback(const EpochCallback &callback) { epochCallback = callback; }
+
+    /**
+     * @brief Set the held-out samples evaluated during training.
+     *
+     * Every `interval` epochs (and after the last one), the accuracy on the first `maxSamples`
+     * samples of the source is computed and reported through the validation callback and, unless
+     * it is computed asynchronously, the epoch callback. Use a source the training never reads
+     * from, e.g. the validation part of a split.
+     *
+     * With `async` set, the evaluation runs on a snapshot of the weights on a background thread
+     * while training continues, and its result is only reported through the validation callback,
+     * which is then called on that thread. Training waits for the pending evaluations before it
+     * returns.
+     *
+     * @param source The source of the validation samples, which must outlive the training, or nullptr to disable validation.
+     * @param interval The number of epochs between two evaluations.
+     * @param maxSamples The number of samples evaluated, 0 for all of them.
+     * @param async Whether to evaluate on a background thread.
+     */
+    void setValidation(BatchSource<Scalar> *source, int interval = 1, long maxSamples = 0, bool async = false)
+    {
+      validationSource = source;
+      validationInterval = std::max(1, interval);
+      validationSamples = maxSamples;
+      validationAsync = async;
+    }
+
+    /**
+     * @brief Set the function called with the result of every evaluation of the validation samples.
+     *
+     * @param callback The function to call, or an empty function to stop reporting.
+     */
+    void setValidationCallback(const ValidationCallback &callback) { validationCallback = callback; }
 
     /**
      * @brief Train the neural network.
      *
      * This method trains the neural network using the provided input and target data.
      * It performs forward and backward passes, updating weights based on the gradients.
+     * The output layer must use the softmax activation, as the network is trained with the
+     * softmax cross-entropy loss.
      *
      * @param input The input data for training.
-     * @param target The target output data for training.
+     * @param target The class label of every sample.
+     * @param learningRate The learning rate for weight updates.
+     * @param epochs The number of training epochs.
+     * @throws std::invalid_argument If the output layer does not use the softmax activation, the target does
+     * not hold one label for every sample, or a label is not finite.
+     * @throws std::out_of_range If a label is not a class of the output layer.
+     */
+    void train(const Matrix &input, const Matrix &target, Scalar learningRate, int epochs);
+
+    /**
+     * @brief Train the neural network using mini-batch gradient descent.
+     *
+     * The input is walked in blocks of `batchSize` columns, and the weights are updated after
+     * every block. The blocks are views into the input matrix, so no sample is copied; when
+     * `shuffle` is set, the order in which the blocks are visited is shuffled every epoch.
+     * The loss and accuracy of every epoch are reported through the epoch callback, see
+     * setEpochCallback() and setValidation().
+     *
+     * @param input The input data for training, in the form (features, samples).
+     * @param target The class label of every sample. The labels are used as class indices by the
+     * loss, so no one-hot matrix of the targets is ever built.
+     * @param learningRate The learning rate for weight updates.
+     * @param epochs The number of training epochs.
+     * @param batchSize The number of samples (columns) in each mini-batch.
+     * @param shuffle Whether to visit the mini-batches in a random order every epoch.
+     * @param numThreads The number of worker threads each mini-batch is split across (requires OpenMP).
+     * @throws std::invalid_argument If the output layer does not use the softmax activation, the target does
+     * not hold one label for every sample, or a label is not finite.
+     * @throws std::out_of_range If a label is not a class of the output layer.
+     *
+     * @note Only the order of the blocks is shuffled, not the samples inside them, so the input
+     * should already be in a random order (splitXY shuffles it).
+     */
+    void train(const Matrix &input, const Matrix &target, Scalar learningRate, int epochs, int batchSize, bool shuffle = true, int numThreads = 1);
+
+    /**
+     * @brief Train the neural network using mini-batch gradient descent on a BatchSource.
+     *
+     * Every mini-batch is read from the source into a feature buffer allocated once for the batch
+     * size, and its integer labels into a second preallocated buffer, so the dataset never has to
+     * exist as a whole in floating point form. Batches are read on a background thread
+     * into a pair of such buffers, so the next batch is prepared while the current one is trained
+     * on. When `shuffle` is set, the source visits its samples in a new random order every epoch.
+     * The loss and accuracy of every epoch are reported through the epoch callback, see
+     * setEpochCallback() and setValidation().
+     *
+     * @param source The source of the training samples.
      * @param learningRate The learning rate for weight updates.
      * @param epochs The number of training epochs.
+     * @param batchSize The number of samples (columns) in each mini-batch.
+     * @param shuffle Whether to visit the samples in a random order every epoch.
+     * @param numThreads The number of worker threads each mini-batch is split across (requires OpenMP).
+     * @throws std::invalid_argument If the samples of the source or of the validation source do not have
+     * as many features as the network has inputs.
+     * @throws std::out_of_range If a label is not a class of the output layer.
      */
-    void train(const Eigen::MatrixXd &input, const Eigen::MatrixXd &target, double learningRate, int epochs);
+    void train(BatchSource<Scalar> &source, Scalar learningRate, int epochs, int batchSize, bool shuffle = true, int numThreads = 1);
 
     /**
      * @brief Calculate the accuracy of the neural network.
@@ -66,7 +232,21 @@ namespace FlexNN
      * @param Y The target output data for comparison.
      * @return The accuracy as a double value.
      */
-    double accuracy(const Eigen::MatrixXd &X, const Eigen::MatrixXd &Y);
+    double accuracy(const Matrix &X, const Matrix &Y) const;
+
+    /**
+     * @brief Calculate the accuracy of the neural network on the samples of a BatchSource.
+     *
+     * The samples are read and evaluated in batches, in the order of the source. The next batch is
+     * read on a background thread while the current one is evaluated.
+     *
+     * @param source The source of the samples to evaluate, which concurrent callers must not share.
+     * @param batchSize The number of samples evaluated at once.
+     * @param maxSamples The number of samples to evaluate from the start of the source, 0 for all of them.
+     * @return The accuracy as a double value.
+     * @throws std::invalid_argument If the samples of the source do not have as many features as the network has inputs.
+     */
+    double accuracy(BatchSource<Scalar> &source, int batchSize = 1024, long maxSamples = 0) const;
 
     /**
      * @brief Predict the output for given input data.
@@ -75,22 +255,155 @@ namespace FlexNN
      * for the provided input data.
      *
      * @param input The input data for prediction.
-     * @return The predicted output as an Eigen::MatrixXd.
+     * @return The predicted output as an Eigen matrix.
      */
-    Eigen::MatrixXd predict(const Eigen::MatrixXd &input)
+    Matrix predict(const Matrix &input) const
     {
-      auto outputs = forward(input);
-      return outputs.back(); // Return the final output (activation of the last layer)
+      BasicWorkspace<Scalar> workspace;
+      return predict(input, workspace); // Copies the final output out of the local workspace
     }
 
+    /**
+     * @brief Predict the output for given input data, in a workspace provided by the caller.
+     *
+     * The workspace is grown to fit the network and the batch if needed, so a caller reusing
+     * its own workspace does not allocate in the steady state.
+     *
+     * @param input The input data for prediction.
+     * @param workspace The workspace to store the activations of each layer in.
+     * @return A view of the output of the last layer, valid until the workspace is used again.
+     */
+    Eigen::Ref<const Matrix> predict(const Eigen::Ref<const Matrix> &input, BasicWorkspace<Scalar> &workspace) const
+    {
+      workspace.reserve(layers, input.cols(), false); // Inference needs no gradient buffers
+      forward(input, workspace);
+      return workspace.activation(layers.size() - 1); // Return the final output (activation of the last layer)
+    }
+
+    /**
+     * @brief Predict the output for a single sample, with low latency.
+     *
+     * Works like the overload below, in a scratch vector owned by the calling thread.
+     *
+     * @param input The input sample.
+     * @return A view of the output of the last layer, valid until the next call of predictOne() on the same thread.
+     */
+    Eigen::Ref<const Vector> predictOne(const Eigen::Ref<const Vector> &input) const;
+
+    /**
+     * @brief Predict the output for a single sample, with low latency, in a scratch vector provided by the caller.
+     *
+     * Every layer is a matrix-vector product, and the activations ping-pong between the two
+     * halves of the scratch vector, so no intermediate is stored. The scratch is grown to twice
+     * the width of the widest layer if needed, so steady-state calls do not allocate.
+     *
+     * @param input The input sample.
+     * @param scratch The vector to store the activations in.
+     * @return A view of the output of the last layer, valid until the scratch is used again.
+     */
+    Eigen::Ref<const Vector> predictOne(const Eigen::Ref<const Vector> &input, Vector &scratch) const;
+
+    /**
+     * @brief Getter for the input size.
+     *
+     * @return int The number of features of a sample, the input size of the first layer.
+     */
+    int getInputSize() const { return layers.front().getInputSize(); }
+
+    /**
+     * @brief Getter for the output size.
+     *
+     * @return int The number of outputs of the network, the output size of the last layer.
+     */
+    int getOutputSize() const { return layers.back().getOutputSize(); }
+
+    /**
+     * @brief Save the architecture, weights and biases of the network to a model file.
+     *
+     * The file starts with a 64 byte header (magic "FLEXNNMD", format version, scalar type of the
+     * weights, number of layers and the offset of the layer table), followed by the layer table (the
+     * input size, output size and activation of every layer, and the offsets of its weights and
+     * biases) and then the raw column-major weights and biases, each on a 64 byte boundary. Numbers
+     * are stored in the byte order of the machine that wrote the file. The optimizer state is not
+     * saved.
+     *
+     * The file is written under a temporary name and renamed over the target, so processes that
+     * have mapped an earlier version keep reading it unharmed.
+     *
+     * @param filename The path to the model file to create (or replace).
+     * @throws std::runtime_error If the file cannot be written.
+     */
+    void save(const std::string &filename) const;
+
+    /**
+     * @brief Load a network from a model file written by save().
+     *
+     * The file is memory-mapped, and if it stores weights of the scalar type of the network, the
+     * layers point straight into the mapping: nothing is read or copied up front, the pages are
+     * shared with every other process that maps the same file, and the mapping stays alive as
+     * long as a layer uses it. The weights of a layer are only copied when it is first trained.
+     * Weights of the other scalar type are converted while loading.
+     *
+     * @param filename The path to the model file.
+     * @return The network stored in the file.
+     * @throws std::runtime_error If the file cannot be mapped or is not a valid model file.
+     */
+    static BasicNeuralNetwork load(const std::string &filename);
+
   private:
+    template <typename>
+    friend class AsyncEvaluator; // Refreshes the layers of its snapshot networks in place
+
     /**
      * @brief A vector of Layer objects representing the layers of the neural network.
      *
      * This vector holds all the layers in the neural network, allowing for flexible
      * architecture and easy manipulation of the network structure.
      */
-    std::vector<Layer> layers;
+    std::vector<BasicLayer<Scalar>> layers;
+
+    /**
+     * @brief Workspaces reused across mini-batches, one per worker thread.
+     *
+     * These own every activation and gradient buffer of the training loop, so that once they
+     * are reserved for a batch size, steady-state training does not allocate.
+     */
+    std::vector<BasicWorkspace<Scalar>> workspaces;
+
+    /**
+     * @brief The update rule applied to the gradients of every mini-batch.
+     */
+    Optimizer optimizer;
+
+    /**
+     * @brief Function called with the metrics of every training epoch, if set.
+     */
+    EpochCallback epochCallback;
+
+    /**
+     * @brief Source of the held-out samples evaluated during training, or nullptr.
+     */
+    BatchSource<Scalar> *validationSource;
+
+    /**
+     * @brief Number of epochs between two evaluations of the validation samples.
+     */
+    int validationInterval;
+
+    /**
+     * @brief Number of validation samples evaluated, 0 for all of them.
+     */
+    long validationSamples;
+
+    /**
+     * @brief Whether the validation samples are evaluated on a background thread.
+     */
+    bool validationAsync;
+
+    /**
+     * @brief Function called with the result of every evaluation of the validation samples, if set.
+     */
+    ValidationCallback validationCallback;
 
     /**
      * @brief Forward pass through the neural network.
@@ -99,33 +412,82 @@ namespace FlexNN
      * computing the activations for each layer based on the input data.
      *
      * @param input The input data for the forward pass.
-     * @return A vector of Eigen::MatrixXd containing the outputs of each layer.
+     * @param workspace The workspace to store the activations of each layer in.
      */
-    std::vector<Eigen::MatrixXd> forward(const Eigen::MatrixXd &input);
+    void forward(const Eigen::Ref<const Matrix> &input, BasicWorkspace<Scalar> &workspace) const;
 
     /**
      * @brief Backward pass through the neural network.
      *
      * This method performs a backward pass through the neural network, calculating
-     * the gradients for each layer based on the outputs and target data.
+     * the gradients for each layer based on the outputs of the forward pass and the class labels.
+     *
+     * @param input The input data of the forward pass.
+     * @param labels The class of every sample.
+     * @param workspace The workspace holding the forward pass outputs, receives the gradients.
+     * @param scale The factor the summed gradients are multiplied by (1 / number of samples in the batch).
+     * @param correct Receives the number of samples the forward pass classified correctly.
+     * @return The softmax cross-entropy loss summed over the samples.
+     */
+    double backward(const Eigen::Ref<const Matrix> &input, const Eigen::Ref<const Eigen::VectorXi> &labels, BasicWorkspace<Scalar> &workspace, Scalar scale, long &correct) const;
+
+    /**
+     * @brief Compute the gradients for a mini-batch, optionally split across worker threads.
      *
-     * @param outputs The outputs from the forward pass.
-     * @param target The target output data for training.
-     * @return A vector of Eigen::MatrixXd containing the gradients for each layer.
+     * Each worker runs a forward and backward pass on its own slice of the columns in its own
+     * workspace, and the partial gradients are then summed pairwise in a tree, so the result
+     * equals the gradients of the whole mini-batch.
+     *
+     * @param input The input data of the mini-batch.
+     * @param labels The class of every sample of the mini-batch.
+     * @param numThreads The number of worker threads to split the mini-batch across.
+     * @param loss Receives the loss summed over the samples of the mini-batch.
+     * @param correct Receives the number of samples of the mini-batch the forward pass classified correctly.
+     * @return The workspace holding the gradients of the whole mini-batch.
      */
-    std::vector<Eigen::MatrixXd> backward(const std::vector<Eigen::MatrixXd> &outputs, const Eigen::MatrixXd &target);
+    const BasicWorkspace<Scalar> &computeGradients(const Eigen::Ref<const Matrix> &input, const Eigen::Ref<const Eigen::VectorXi> &labels, int numThreads, double &loss, long &correct);
 
     /**
      * @brief Update the weights of the neural network.
      *
      * This method updates the weights of each layer based on the calculated gradients
-     * and the specified learning rate.
+     * and the specified learning rate, with the update rule set by setOptimizer().
      *
-     * @param gradients A vector of Eigen::MatrixXd containing the gradients for each layer.
+     * @param gradients The workspace holding the gradients for each layer.
      * @param learningRate The learning rate for updating weights.
      */
-    void updateWeights(const std::vector<Eigen::MatrixXd> &gradients, double learningRate);
+    void updateWeights(const BasicWorkspace<Scalar> &gradients, Scalar learningRate);
+
+    /**
+     * @brief Finish a training epoch: evaluate the validation samples if due and report the metrics.
+     *
+     * @param epoch The index of the epoch, starting at 0.
+     * @param epochs The number of epochs of the training run.
+     * @param loss The loss summed over the samples of the epoch.
+     * @param correct The number of samples of the epoch classified correctly.
+     * @param samples The number of samples of the epoch.
+     * @param evaluator The background evaluator to submit the validation to, or nullptr to validate synchronously.
+     */
+    void endEpoch(int epoch, int epochs, double loss, long correct, long samples, AsyncEvaluator<Scalar> *evaluator);
+
+    /**
+     * @brief Check that the samples of a source fit the input layer, before any batch is read from it.
+     *
+     * @param source The source to check.
+     * @throws std::invalid_argument If the samples do not have as many features as the network has inputs.
+     */
+    void checkFeatureCount(const BatchSource<Scalar> &source) const;
   };
+
+  /**
+   * @brief A neural network with double precision weights and activations.
+   */
+  typedef BasicNeuralNetwork<double> NeuralNetwork;
+
+  /**
+   * @brief A neural network with single precision weights and activations.
+   */
+  typedef BasicNeuralNetwork<float> NeuralNetworkF;
 }
 
 #endif // FlexNN_H
\ No newline at end of file
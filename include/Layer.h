@@ -11,9 +11,13 @@
 #ifndef FlexNN_Layer_H
 #define FlexNN_Layer_H
 
-#include <utility>
+#include <memory>
+#include <string>
 #include <Eigen/Dense>
 
+#include "MappedFile.h"
+#include "Optimizer.h"
+
 /**
  * @namespace FlexNN
  * @brief Namespace for the FlexNN neural network library.
@@ -24,6 +28,29 @@
  */
 namespace FlexNN
 {
+  /**
+   * @enum Activation
+   * @brief Activation functions supported by a Layer.
+   *
+   * The activation is resolved once when the layer is built, so the forward and backward passes
+   * dispatch to a kernel specialized for it instead of comparing strings on every call. The
+   * values are stored in model files and must not change.
+   */
+  enum class Activation
+  {
+    Linear = 0, ///< No activation, the layer outputs its linear combination (Z).
+    ReLU = 1,   ///< Rectified linear unit, max(0, Z).
+    Softmax = 2 ///< Column-wise softmax, used by the output layer of a classifier.
+  };
+
+  /**
+   * @brief Parse the name of an activation function.
+   *
+   * @param name The name of the activation function ("relu", "softmax" or "linear").
+   * @return The matching Activation, or Activation::Linear for any other name.
+   */
+  Activation parseActivation(const std::string &name);
+
   /**
    * @class Layer
    * @brief Represents a single layer in a neural network.
@@ -33,10 +60,30 @@ namespace FlexNN
    *
    * This class is designed to be flexible and can be used with different activation functions.
    * It supports both relu and softmax activation functions by default, but can be extended to include others.
+   *
+   * The class is templated on the scalar type of its weights and activations; use the Layer
+   * (double) and LayerF (float) typedefs.
+   *
+   * The layers of a network loaded from a model file do not own their weights and biases, they
+   * point into the memory-mapped file (which they keep alive). They are copied into the layer on
+   * the first update, so a loaded network can be trained further; until then the file is never
+   * written to and its pages are shared with every other process that maps it.
+   *
+   * @tparam Scalar The floating point type of the weights and activations (float or double).
    */
-  class Layer
+  template <typename Scalar>
+  class BasicLayer
   {
   public:
+    /**
+     * @brief Matrix type used for weights and activations.
+     */
+    typedef Eigen::MatrixX<Scalar> Matrix;
+    /**
+     * @brief Vector type used for biases.
+     */
+    typedef Eigen::VectorX<Scalar> Vector;
+
     /**
      * @brief Constructor for the Layer class.
      *
@@ -44,83 +91,201 @@ namespace FlexNN
      *
      * @param inputSize The size of the input to this layer.
      * @param outputSize The size of the output from this layer (also the number of neurons of this layer).
-     * @param activationFunction The activation function to be used in this layer (default is "relu").
+     * @param activation The activation function to be used in this layer (default is ReLU).
      *
-     * @note If this is the last layer, the activation function should be "softmax".
+     * @note If this is the last layer, the activation function should be Activation::Softmax.
      */
-    Layer(int inputSize, int outputSize, const std::string &activationFunction = "relu")
-        : inputSize(inputSize), outputSize(outputSize), activationFunction(activationFunction)
+    BasicLayer(int inputSize, int outputSize, Activation activation = Activation::ReLU)
+        : inputSize(inputSize), outputSize(outputSize), activation(activation), mappedW(nullptr), mappedb(nullptr),
+          stateType(OptimizerType::SGD), step(0)
     {
       // Initialize weights and biases
-      W = Eigen::MatrixXd::Random(outputSize, inputSize) * 0.5;
-      b = Eigen::VectorXd::Random(outputSize) * 0.5;
+      W = Matrix::Random(outputSize, inputSize) * Scalar(0.5);
+      b = Vector::Random(outputSize) * Scalar(0.5);
     }
 
+    /**
+     * @brief Constructor for the Layer class, taking the activation function by name.
+     *
+     * Initializes the layer with random weights and biases.
+     *
+     * @param inputSize The size of the input to this layer.
+     * @param outputSize The size of the output from this layer (also the number of neurons of this layer).
+     * @param activationFunction The name of the activation function to be used in this layer ("relu" or "softmax").
+     *
+     * @note If this is the last layer, the activation function should be "softmax".
+     */
+    BasicLayer(int inputSize, int outputSize, const std::string &activationFunction)
+        : BasicLayer(inputSize, outputSize, parseActivation(activationFunction)) {}
+
     /**
      * @brief Getters for weights.
      *
-     * These methods return the weights of the layer.
+     * These methods return a read-only view of the weights of the layer, without copying them.
+     *
+     * @return Eigen::Ref<const Matrix> The weights of the layer.
+     */
+    Eigen::Ref<const Matrix> getWeights() const
+    {
+      return weights(); // Return the weights of the layer
+    }
+
+    /**
+     * @brief Getter for the input size.
+     *
+     * @return int The size of the input to this layer.
+     */
+    int getInputSize() const
+    {
+      return inputSize;
+    }
+
+    /**
+     * @brief Getter for the output size.
+     *
+     * @return int The size of the output from this layer (the number of neurons).
+     */
+    int getOutputSize() const
+    {
+      return outputSize;
+    }
+
+    /**
+     * @brief Getter for the activation function.
      *
-     * @return Eigen::MatrixXd The weights of the layer.
+     * @return Activation The activation function used in this layer.
      */
-    Eigen::MatrixXd getWeights() const
+    Activation getActivation() const
     {
-      return W; // Return the weights of the layer
+      return activation;
     }
 
     /**
      * @brief Getters for biases.
      *
-     * These methods return the biases of the layer.
+     * These methods return a read-only view of the biases of the layer, without copying them.
+     *
+     * @return Eigen::Ref<const Vector> The biases of the layer.
+     */
+    Eigen::Ref<const Vector> getBiases() const
+    {
+      return biases(); // Return the biases of the layer
+    }
+
+    /**
+     * @brief Whether the weights and biases are read from a memory-mapped model file.
      *
-     * @return Eigen::VectorXd The biases of the layer.
+     * @return bool true until the first update of a layer loaded from a model file.
      */
-    Eigen::VectorXd getBiases() const
+    bool isMapped() const
     {
-      return b; // Return the biases of the layer
+      return mapping != nullptr;
     }
 
+    /**
+     * @brief Copy the weights and biases of another layer of the same shape.
+     *
+     * Only the parameters are copied, into the buffers this layer already has, or the mapping
+     * is shared if the other layer still reads them from a model file. The optimizer state of
+     * this layer is left as it is.
+     *
+     * @param other The layer to copy the parameters of.
+     */
+    void copyParameters(const BasicLayer &other);
+
     /**
      * @brief Update weights and biases.
      *
      * This method updates the weights and biases of the layer using the provided gradients
-     * and a specified learning rate.
+     * and a specified learning rate. The gradients are read where they are (typically in the
+     * training workspace) and each parameter is updated, together with the optimizer state
+     * kept next to it, in a single in-place pass with no temporaries. Mapped weights and biases
+     * are first copied into the layer.
      *
      * @param dW The gradient of the weights.
      * @param db The gradient of the biases.
      * @param learningRate The learning rate for updating the weights and biases.
+     * @param optimizer The update rule to apply.
      */
-    void updateWeights(const Eigen::MatrixXd &dW, const Eigen::VectorXd &db, double learningRate)
-    {
-      W -= learningRate * dW; // Update weights
-      b -= learningRate * db; // Update biases
-    }
+    void updateWeights(const Eigen::Ref<const Matrix> &dW, const Eigen::Ref<const Vector> &db, Scalar learningRate,
+                       const Optimizer &optimizer = Optimizer());
 
     /**
      * @brief Forward pass through the layer.
      *
      * This method computes the output of the layer given an input matrix.
-     * It applies the activation function to the linear combination of inputs and weights.
+     * The linear combination of inputs and weights is written straight into the output buffer,
+     * and the bias and activation function are then applied to it in a single in-place pass,
+     * so the linear output (Z) is never stored.
      *
      * @param input The input data for the forward pass.
-     * @return A pair containing the linear output (Z) and the activated output (A).
+     * @param A The buffer to store the activated output (A) in, which must already have the right shape.
      */
-    std::pair<Eigen::MatrixXd, Eigen::MatrixXd> forward(const Eigen::MatrixXd &input);
+    void forward(const Eigen::Ref<const Matrix> &input, Eigen::Ref<Matrix> A) const;
+
+    /**
+     * @brief Forward pass of a single sample through the layer.
+     *
+     * This works like forward(), but on vectors: the linear combination is a matrix-vector
+     * product written straight into the output, and the bias and activation function are applied
+     * to it in place.
+     *
+     * @param input The input sample.
+     * @param a The buffer to store the activated output in, with one entry per neuron.
+     */
+    void forwardOne(const Eigen::Ref<const Vector> &input, Eigen::Ref<Vector> a) const;
 
     /**
      * @brief Backward pass through the layer.
      *
      * This method computes the gradient of the loss with respect to the inputs of this layer
-     * given the gradients from the next layer.
+     * given the gradients from the next layer. The derivative of the activation function is
+     * recovered from the activated output (for ReLU, A > 0 exactly where Z > 0).
      *
      * @param nextW The weights of the next layer.
      * @param nextdZ The gradients from the next layer.
-     * @param currZ The linear output (Z) of this layer.
-     * @return The gradient of the loss with respect to the inputs of this layer (dZ).
+     * @param currA The activated output (A) of this layer.
+     * @param dZ The buffer to store the gradient of the loss with respect to the inputs of this layer in.
      */
-    Eigen::MatrixXd backward(const Eigen::MatrixXd &nextW, const Eigen::MatrixXd &nextdZ, const Eigen::MatrixXd &currZ);
+    void backward(const Eigen::Ref<const Matrix> &nextW, const Eigen::Ref<const Matrix> &nextdZ,
+                  const Eigen::Ref<const Matrix> &currA, Eigen::Ref<Matrix> dZ) const;
 
   private:
+    template <typename>
+    friend class BasicNeuralNetwork; // Builds the layers of a loaded model
+    template <typename>
+    friend class AsyncEvaluator; // Builds the layers of its snapshots without initializing them
+
+    /**
+     * @brief Constructor for a layer whose weights and biases are stored in a memory-mapped file.
+     *
+     * @param inputSize The size of the input to this layer.
+     * @param outputSize The size of the output from this layer.
+     * @param activation The activation function of this layer.
+     * @param mapping The mapping holding the weights and biases, or nullptr if the caller sets W and b.
+     * @param weights The (outputSize, inputSize) column-major weights inside the mapping.
+     * @param biases The outputSize biases inside the mapping.
+     */
+    BasicLayer(int inputSize, int outputSize, Activation activation, std::shared_ptr<MappedFile> mapping, const Scalar *weights, const Scalar *biases)
+        : inputSize(inputSize), outputSize(outputSize), activation(activation), mapping(mapping), mappedW(weights), mappedb(biases),
+          stateType(OptimizerType::SGD), step(0) {}
+
+    /**
+     * @brief A view of the weights, wherever they are stored.
+     */
+    Eigen::Map<const Matrix> weights() const
+    {
+      return Eigen::Map<const Matrix>(mapping ? mappedW : W.data(), outputSize, inputSize);
+    }
+
+    /**
+     * @brief A view of the biases, wherever they are stored.
+     */
+    Eigen::Map<const Vector> biases() const
+    {
+      return Eigen::Map<const Vector>(mapping ? mappedb : b.data(), outputSize);
+    }
+
     /**
      * @brief Input layer size.
      */
@@ -132,23 +297,69 @@ namespace FlexNN
     /**
      * @brief Activation function used in this layer.
      *
-     * This can be "relu" or "softmax" for now, will implement more later.
+     * This can be linear, relu or softmax for now, will implement more later.
      */
-    std::string activationFunction;
+    Activation activation;
     /**
      * @brief Weights of the layer.
      *
      * This is a matrix where each row corresponds to a neuron in this layer
      * and each column corresponds to an input feature.
      */
-    Eigen::MatrixXd W;
+    Matrix W;
     /**
      * @brief Biases of the layer.
      *
      * This is a vector where each element corresponds to a neuron in this layer.
      */
-    Eigen::VectorXd b;
+    Vector b;
+    /**
+     * @brief The model file the weights and biases are read from, or nullptr if the layer owns them in W and b.
+     */
+    std::shared_ptr<MappedFile> mapping;
+    /**
+     * @brief The weights inside the mapping.
+     */
+    const Scalar *mappedW;
+    /**
+     * @brief The biases inside the mapping.
+     */
+    const Scalar *mappedb;
+    /**
+     * @brief Update rule the optimizer state below belongs to.
+     */
+    OptimizerType stateType;
+    /**
+     * @brief Number of updates applied with the current optimizer state, for the bias correction of Adam.
+     */
+    long step;
+    /**
+     * @brief First optimizer state of the weights (velocity or first moment), empty until needed.
+     */
+    Matrix mW;
+    /**
+     * @brief Second optimizer state of the weights (mean squared gradient), empty until needed.
+     */
+    Matrix vW;
+    /**
+     * @brief First optimizer state of the biases, empty until needed.
+     */
+    Vector mb;
+    /**
+     * @brief Second optimizer state of the biases, empty until needed.
+     */
+    Vector vb;
   };
+
+  /**
+   * @brief A layer with double precision weights and activations.
+   */
+  typedef BasicLayer<double> Layer;
+
+  /**
+   * @brief A layer with single precision weights and activations.
+   */
+  typedef BasicLayer<float> LayerF;
 }
 
 #endif // FlexNN_Layer_H
\ No newline at end of file
@@ -0,0 +1,59 @@
+/**
+ * @file Loss.h
+ * @brief Header file for the loss functions of the FlexNN neural network library.
+ *
+ * This file defines the output stage of the network, which turns the activations of the last
+ * layer and the targets into the value of the loss and the gradient the backward pass starts from.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_Loss_H
+#define FlexNN_Loss_H
+
+#include <Eigen/Dense>
+
+/**
+ * @namespace FlexNN
+ * @brief Namespace for the FlexNN neural network library.
+ *
+ * This namespace contains all the classes and functions related to the FlexNN library,
+ * including the NeuralNetwork class and Layer class. It provides a structured way to organize
+ * the library's components and avoid naming conflicts with other libraries.
+ */
+namespace FlexNN
+{
+  /**
+   * @class SoftmaxCrossEntropy
+   * @brief Cross-entropy loss on top of a softmax output layer.
+   *
+   * For a softmax output, the gradient of the cross-entropy loss with respect to the
+   * pre-activation of the last layer simplifies to A - Y, so the softmax Jacobian never has to be
+   * formed. This stage computes that gradient and the loss value together in a single pass over
+   * the activations and targets.
+   */
+  class SoftmaxCrossEntropy
+  {
+  public:
+    /**
+     * @brief Compute the loss and the output gradient of a batch from integer class labels.
+     *
+     * The one-hot encoding Y of the labels is never built: the gradient A - Y is the activations
+     * with 1 subtracted at the label of every sample, and only the activation at the label enters
+     * the loss. The targets take O(samples) memory instead of O(classes x samples). The
+     * predictions are counted in the same pass, so the accuracy of a training batch comes for free.
+     *
+     * @param A The softmax activations of the last layer, in the form (classes, samples).
+     * @param labels The class of every sample, each in [0, classes).
+     * @param dZ The buffer to store the gradient with respect to the last pre-activation in.
+     * @param correct Receives the number of samples whose largest activation is at their label.
+     * @return The cross-entropy loss summed over the samples of the batch.
+     *
+     * @tparam Scalar The floating point type of the activations (float or double).
+     */
+    template <typename Scalar>
+    static double evaluate(const Eigen::Ref<const Eigen::MatrixX<Scalar>> &A, const Eigen::Ref<const Eigen::VectorXi> &labels,
+                           Eigen::Ref<Eigen::MatrixX<Scalar>> dZ, long &correct);
+  };
+}
+
+#endif // FlexNN_Loss_H
@@ -0,0 +1,79 @@
+/**
+ * @file MappedFile.h
+ * @brief Header file for the MappedFile class in the FlexNN neural network library.
+ *
+ * This file defines the MappedFile class, a read-only memory mapping of a whole file. The
+ * loaders of the library use it to read datasets straight from the page cache instead of
+ * going through stream buffers.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_MappedFile_H
+#define FlexNN_MappedFile_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @namespace FlexNN
+ * @brief Namespace for the FlexNN neural network library.
+ *
+ * This namespace contains all the classes and functions related to the FlexNN library,
+ * including the NeuralNetwork class and Layer class. It provides a structured way to organize
+ * the library's components and avoid naming conflicts with other libraries.
+ */
+namespace FlexNN
+{
+  /**
+   * @class MappedFile
+   * @brief A read-only memory mapping of a file.
+   *
+   * The mapping is created by the constructor and released by the destructor. The class is not
+   * copyable; share it through a std::shared_ptr when several objects point into the mapping.
+   */
+  class MappedFile
+  {
+  public:
+    /**
+     * @brief Map a file into memory.
+     *
+     * @param filename The path to the file to map.
+     * @throws std::runtime_error If the file cannot be opened or mapped.
+     */
+    explicit MappedFile(const std::string &filename);
+
+    /**
+     * @brief Unmap the file.
+     */
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /**
+     * @brief Get the contents of the file.
+     *
+     * @return A pointer to the first byte of the file, or nullptr if the file is empty.
+     */
+    const char *data() const { return bytes; }
+
+    /**
+     * @brief Get the size of the file.
+     *
+     * @return The size of the file in bytes.
+     */
+    size_t size() const { return length; }
+
+  private:
+    /**
+     * @brief Start of the mapping.
+     */
+    const char *bytes;
+    /**
+     * @brief Size of the mapping in bytes.
+     */
+    size_t length;
+  };
+}
+
+#endif // FlexNN_MappedFile_H
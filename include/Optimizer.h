@@ -0,0 +1,104 @@
+/**
+ * @file Optimizer.h
+ * @brief Header file for the optimizers of the FlexNN neural network library.
+ *
+ * This file defines the optimizers a network can be trained with, which turn the gradients of a
+ * mini-batch into an update of the weights and biases of every layer.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_Optimizer_H
+#define FlexNN_Optimizer_H
+
+/**
+ * @namespace FlexNN
+ * @brief Namespace for the FlexNN neural network library.
+ *
+ * This namespace contains all the classes and functions related to the FlexNN library,
+ * including the NeuralNetwork class and Layer class. It provides a structured way to organize
+ * the library's components and avoid naming conflicts with other libraries.
+ */
+namespace FlexNN
+{
+  /**
+   * @enum OptimizerType
+   * @brief Update rules supported by the layers.
+   *
+   * Like the activation, the update rule is dispatched once per parameter tensor to a kernel
+   * specialized for it, which updates the parameters and the optimizer state of the layer in a
+   * single in-place pass.
+   */
+  enum class OptimizerType
+  {
+    SGD,      ///< Plain gradient descent, W -= lr * dW.
+    Momentum, ///< Gradient descent with a velocity, V = beta1 * V + dW, W -= lr * V.
+    Nesterov, ///< Nesterov momentum, V = beta1 * V + dW, W -= lr * (dW + beta1 * V).
+    RMSProp,  ///< S = beta2 * S + (1 - beta2) * dW^2, W -= lr * dW / (sqrt(S) + epsilon).
+    Adam      ///< Bias-corrected first (beta1) and second (beta2) moment estimates of the gradient.
+  };
+
+  /**
+   * @struct Optimizer
+   * @brief An update rule and its hyperparameters.
+   *
+   * The learning rate is passed to train() separately. The state of the update rule (velocities
+   * and moment estimates) lives in the layers, next to the weights and biases it belongs to; it
+   * is allocated on the first update that needs it and reset when the update rule changes.
+   */
+  struct Optimizer
+  {
+    OptimizerType type; ///< The update rule.
+    double beta1;       ///< Momentum coefficient (Momentum, Nesterov) or decay of the first moment (Adam).
+    double beta2;       ///< Decay of the mean squared gradient (RMSProp, Adam).
+    double epsilon;     ///< Added to the denominator of the RMSProp and Adam updates.
+
+    /**
+     * @brief Constructor for the Optimizer struct.
+     *
+     * @param type The update rule.
+     * @param beta1 Momentum coefficient or decay of the first moment.
+     * @param beta2 Decay of the mean squared gradient.
+     * @param epsilon Added to the denominator of the RMSProp and Adam updates.
+     */
+    explicit Optimizer(OptimizerType type = OptimizerType::SGD, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8)
+        : type(type), beta1(beta1), beta2(beta2), epsilon(epsilon) {}
+
+    /**
+     * @brief Plain gradient descent.
+     */
+    static Optimizer sgd() { return Optimizer(OptimizerType::SGD); }
+
+    /**
+     * @brief Gradient descent with momentum.
+     *
+     * @param beta The momentum coefficient.
+     */
+    static Optimizer momentum(double beta = 0.9) { return Optimizer(OptimizerType::Momentum, beta); }
+
+    /**
+     * @brief Gradient descent with Nesterov momentum.
+     *
+     * @param beta The momentum coefficient.
+     */
+    static Optimizer nesterov(double beta = 0.9) { return Optimizer(OptimizerType::Nesterov, beta); }
+
+    /**
+     * @brief RMSProp.
+     *
+     * @param decay The decay of the mean squared gradient.
+     * @param epsilon Added to the denominator of the update.
+     */
+    static Optimizer rmsprop(double decay = 0.9, double epsilon = 1e-8) { return Optimizer(OptimizerType::RMSProp, 0.0, decay, epsilon); }
+
+    /**
+     * @brief Adam.
+     *
+     * @param beta1 The decay of the first moment estimate.
+     * @param beta2 The decay of the second moment estimate.
+     * @param epsilon Added to the denominator of the update.
+     */
+    static Optimizer adam(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8) { return Optimizer(OptimizerType::Adam, beta1, beta2, epsilon); }
+  };
+}
+
+#endif // FlexNN_Optimizer_H
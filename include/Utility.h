@@ -26,6 +26,21 @@
  */
 namespace FlexNN
 {
+  /**
+   * @enum DataLayout
+   * @brief How the samples of a dataset are laid out in a feature matrix.
+   */
+  enum class DataLayout
+  {
+    SamplesByFeatures, ///< One row per sample, the layout of the CSV file.
+    FeaturesBySamples  ///< One column per sample, the layout NeuralNetwork expects.
+  };
+
+  template <typename Scalar>
+  class MatrixBatchSource;
+
+  class Dataset;
+
   /**
    * @brief One-hot encodes a vector of class labels.
    *
@@ -34,9 +49,12 @@ namespace FlexNN
    *
    * @param Y The input vector of class labels.
    * @param num_classes The number of unique classes.
-   * @return An Eigen::MatrixXd where each row is a one-hot encoded vector for the corresponding class label.
+   * @return An Eigen matrix where each row is a one-hot encoded vector for the corresponding class label.
+   *
+   * @tparam Scalar The floating point type of the labels and the result (float or double).
    */
-  Eigen::MatrixXd oneHotEncode(const Eigen::VectorXd &Y, int num_classes);
+  template <typename Scalar>
+  Eigen::MatrixX<Scalar> oneHotEncode(const Eigen::VectorX<Scalar> &Y, int num_classes);
 
   /**
    * @brief Reads a CSV file and splits it into features (X) and labels (Y).
@@ -44,12 +62,58 @@ namespace FlexNN
    * This function reads a CSV file where the first column is considered the label (Y)
    * and the remaining columns are considered features (X). It populates the provided
    * Eigen matrices with the data from the CSV file.
+   * The file is memory-mapped and parsed in parallel, newline-aligned chunks straight into the
+   * provided matrices.
+   *
+   * @param filename The path to the CSV file to read.
+   * @param X The Eigen matrix to store the features (all columns except the first).
+   * @param Y The Eigen vector to store the labels (the first column).
+   * @throws std::runtime_error If the file cannot be read or a row is malformed.
+   *
+   * @tparam Scalar The floating point type to store the data as (float or double).
+   */
+  template <typename Scalar>
+  void readCSV_XY(const std::string &filename, Eigen::MatrixX<Scalar> &X, Eigen::VectorX<Scalar> &Y);
+
+  /**
+   * @brief Reads a CSV file into features (X) and labels (Y) with a given layout and scaling.
+   *
+   * This works like the overload above, but every feature is multiplied by `scale` as it is parsed
+   * and stored directly in the requested layout. Loading with DataLayout::FeaturesBySamples and a
+   * scale of 1/255 gives normalized MNIST data in the form the network expects, without separate
+   * normalization and transposition passes.
    *
    * @param filename The path to the CSV file to read.
-   * @param X The Eigen::MatrixXd to store the features (all columns except the first).
-   * @param Y The Eigen::VectorXd to store the labels (the first column).
+   * @param X The Eigen matrix to store the features (all columns except the first).
+   * @param Y The Eigen vector to store the labels (the first column).
+   * @param layout The layout to store the features in.
+   * @param scale The factor every feature is multiplied by.
+   * @throws std::runtime_error If the file cannot be read or a row is malformed.
+   *
+   * @tparam Scalar The floating point type to store the data as (float or double).
    */
-  void readCSV_XY(const std::string &filename, Eigen::MatrixXd &X, Eigen::VectorXd &Y);
+  template <typename Scalar>
+  void readCSV_XY(const std::string &filename, Eigen::MatrixX<Scalar> &X, Eigen::VectorX<Scalar> &Y, DataLayout layout, Scalar scale = Scalar(1));
+
+  /**
+   * @brief Opens a pair of IDX files (the binary format MNIST is distributed in) as a Dataset.
+   *
+   * Both files are memory-mapped and only their big-endian headers are read: the images must be
+   * unsigned bytes with at least one dimension besides the sample count (e.g. 60000 x 28 x 28),
+   * and the labels unsigned bytes with one dimension. The returned Dataset points straight into
+   * the mappings, so no pixel is parsed or copied; every image becomes a column of the
+   * (features, samples) feature matrix, which is how IDX stores them. Train on it through a
+   * DatasetBatchSource, which applies `scale` one mini-batch at a time (include Dataset.h to use
+   * the result).
+   *
+   * @param imagesFilename The path to the IDX file of the images (e.g. train-images-idx3-ubyte).
+   * @param labelsFilename The path to the IDX file of the labels (e.g. train-labels-idx1-ubyte).
+   * @param scale The feature scale of the dataset, 1/255 to normalize pixels.
+   * @return A dataset of uint8_t features and labels.
+   * @throws std::runtime_error If a file cannot be mapped, is not an IDX file of unsigned bytes,
+   * is truncated, or the files do not hold the same number of samples.
+   */
+  Dataset readIDX(const std::string &imagesFilename, const std::string &labelsFilename, double scale = 1.0);
 
   /**
    * @brief Splits the dataset into multiple sets based on specified proportions.
@@ -57,13 +121,39 @@ namespace FlexNN
    * This function takes a dataset represented by features (X) and labels (Y),
    * and splits it into multiple sets according to the provided proportions.
    *
-   * @param X The input feature matrix (Eigen::MatrixXd).
-   * @param Y The input label vector (Eigen::VectorXd).
+   * @param X The input feature matrix.
+   * @param Y The input label vector.
    * @param proportions A vector of doubles representing the proportions for each split.
+   * @param layout The layout of X (and of the returned feature matrices).
    * @return A vector of pairs, where each pair contains a feature matrix and a label vector for each split.
+   *
+   * @tparam Scalar The floating point type of the data (float or double).
+   */
+  template <typename Scalar>
+  std::vector<std::pair<Eigen::MatrixX<Scalar>, Eigen::VectorX<Scalar>>>
+  splitXY(const Eigen::MatrixX<Scalar> &X, const Eigen::VectorX<Scalar> &Y, const std::vector<double> &proportions,
+          DataLayout layout = DataLayout::SamplesByFeatures);
+
+  /**
+   * @brief Splits the dataset into multiple views based on specified proportions, without copying it.
+   *
+   * This works like splitXY(), but instead of copying the samples of every split into new
+   * matrices, each split is a MatrixBatchSource holding a shuffled list of sample indices into X
+   * and Y. Samples are only gathered when a batch is read from a view, so the splits share the
+   * memory of the dataset (include BatchSource.h to use them).
+   *
+   * @param X The input feature matrix, which must outlive the views.
+   * @param Y The input label vector, which must outlive the views.
+   * @param proportions A vector of doubles representing the proportions for each split.
+   * @param layout The layout of X.
+   * @return A vector of views, one for each split.
+   *
+   * @tparam Scalar The floating point type of the data (float or double).
    */
-  std::vector<std::pair<Eigen::MatrixXd, Eigen::VectorXd>>
-  splitXY(const Eigen::MatrixXd &X, const Eigen::VectorXd &Y, const std::vector<double> &proportions);
+  template <typename Scalar>
+  std::vector<MatrixBatchSource<Scalar>>
+  splitXYView(const Eigen::MatrixX<Scalar> &X, const Eigen::VectorX<Scalar> &Y, const std::vector<double> &proportions,
+              DataLayout layout = DataLayout::SamplesByFeatures);
 }
 
 #endif // FlexNN_UTILITY_H
\ No newline at end of file
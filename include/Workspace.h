@@ -0,0 +1,182 @@
+/**
+ * @file Workspace.h
+ * @brief Header file for the Workspace class in the FlexNN neural network library.
+ *
+ * This file defines the Workspace class, which owns every buffer a forward and backward pass
+ * writes to: the activations of each layer, the gradients of the loss with respect to the
+ * pre-activations, and the weight and bias gradients. Reusing one workspace across
+ * mini-batches keeps training free of per-step allocations.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_Workspace_H
+#define FlexNN_Workspace_H
+
+#include <vector>
+#include <Eigen/Dense>
+
+#include "Layer.h"
+
+/**
+ * @namespace FlexNN
+ * @brief Namespace for the FlexNN neural network library.
+ *
+ * This namespace contains all the classes and functions related to the FlexNN library,
+ * including the NeuralNetwork class and Layer class. It provides a structured way to organize
+ * the library's components and avoid naming conflicts with other libraries.
+ */
+namespace FlexNN
+{
+  /**
+   * @class Workspace
+   * @brief Preallocated buffers for the forward and backward passes of a neural network.
+   *
+   * The buffers are allocated for a maximum number of columns (the capacity) by reserve(). Any
+   * batch up to that size can then be processed by calling setBatchSize(), which only changes the
+   * shape of the views handed out by the accessors and never allocates. Since the matrices are
+   * stored column-major, a batch smaller than the capacity simply uses the leading columns.
+   *
+   * @tparam Scalar The floating point type of the network the workspace is used with.
+   */
+  template <typename Scalar>
+  class BasicWorkspace
+  {
+  public:
+    /**
+     * @brief Matrix type of the buffers.
+     */
+    typedef Eigen::MatrixX<Scalar> Matrix;
+    /**
+     * @brief Vector type of the bias gradients.
+     */
+    typedef Eigen::VectorX<Scalar> Vector;
+
+    /**
+     * @brief Constructor for the Workspace class.
+     *
+     * Creates an empty workspace; call reserve() before using it.
+     */
+    BasicWorkspace() : batchSize(0), capacity(0), withGradients(false) {}
+
+    /**
+     * @brief Allocate the buffers for a network and a maximum batch size.
+     *
+     * Does nothing if the workspace already fits the given layers and batch size, so it is cheap
+     * to call before every batch.
+     *
+     * @param layers The layers of the network the workspace is used with.
+     * @param maxBatchSize The maximum number of columns (samples) in a batch.
+     * @param withGradients Whether to allocate the buffers needed by the backward pass.
+     */
+    void reserve(const std::vector<BasicLayer<Scalar>> &layers, int maxBatchSize, bool withGradients = true);
+
+    /**
+     * @brief Set the number of columns of the current batch.
+     *
+     * @param cols The number of columns (samples) in the current batch, at most the capacity.
+     */
+    void setBatchSize(int cols) { batchSize = cols; }
+
+    /**
+     * @brief Get the number of columns of the current batch.
+     *
+     * @return The number of columns (samples) in the current batch.
+     */
+    int getBatchSize() const { return batchSize; }
+
+    /**
+     * @brief Get the activation (A) of a layer for the current batch.
+     *
+     * @param layer The index of the layer.
+     * @return A view of the activation matrix.
+     */
+    Eigen::Map<Matrix> activation(size_t layer) { return view(As[layer]); }
+
+    /**
+     * @brief Get the gradient of the loss with respect to the pre-activation (dZ) of a layer.
+     *
+     * @param layer The index of the layer.
+     * @return A view of the dZ matrix for the current batch.
+     */
+    Eigen::Map<Matrix> delta(size_t layer) { return view(dZs[layer]); }
+
+    /**
+     * @brief Get the weight gradient (dW) of a layer.
+     *
+     * @param layer The index of the layer.
+     * @return The weight gradient matrix.
+     */
+    Matrix &weightGradient(size_t layer) { return dWs[layer]; }
+
+    /**
+     * @brief Get the weight gradient (dW) of a layer.
+     *
+     * @param layer The index of the layer.
+     * @return The weight gradient matrix.
+     */
+    const Matrix &weightGradient(size_t layer) const { return dWs[layer]; }
+
+    /**
+     * @brief Get the bias gradient (db) of a layer.
+     *
+     * @param layer The index of the layer.
+     * @return The bias gradient vector.
+     */
+    Vector &biasGradient(size_t layer) { return dbs[layer]; }
+
+    /**
+     * @brief Get the bias gradient (db) of a layer.
+     *
+     * @param layer The index of the layer.
+     * @return The bias gradient vector.
+     */
+    const Vector &biasGradient(size_t layer) const { return dbs[layer]; }
+
+  private:
+    /**
+     * @brief Wrap the leading batchSize columns of a buffer.
+     */
+    Eigen::Map<Matrix> view(Matrix &buffer) { return Eigen::Map<Matrix>(buffer.data(), buffer.rows(), batchSize); }
+
+    /**
+     * @brief Number of columns in the current batch.
+     */
+    int batchSize;
+    /**
+     * @brief Number of columns the buffers are allocated for.
+     */
+    int capacity;
+    /**
+     * @brief Whether the backward pass buffers are allocated.
+     */
+    bool withGradients;
+    /**
+     * @brief Activation (A) buffers, one per layer.
+     */
+    std::vector<Matrix> As;
+    /**
+     * @brief dZ buffers, one per layer.
+     */
+    std::vector<Matrix> dZs;
+    /**
+     * @brief Weight gradient buffers, one per layer.
+     */
+    std::vector<Matrix> dWs;
+    /**
+     * @brief Bias gradient buffers, one per layer.
+     */
+    std::vector<Vector> dbs;
+  };
+
+  /**
+   * @brief A workspace for double precision networks.
+   */
+  typedef BasicWorkspace<double> Workspace;
+
+  /**
+   * @brief A workspace for single precision networks.
+   */
+  typedef BasicWorkspace<float> WorkspaceF;
+}
+
+#endif // FlexNN_Workspace_H
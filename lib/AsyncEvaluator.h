@@ -0,0 +1,229 @@
+/**
+ * @file AsyncEvaluator.h
+ * @brief Internal background validation of the FlexNN neural network library.
+ *
+ * This file defines the AsyncEvaluator class, which evaluates snapshots of the weights of a
+ * network on a validation set on its own thread while training goes on. It is used by the
+ * training loops and is not part of the public headers.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_AsyncEvaluator_H
+#define FlexNN_AsyncEvaluator_H
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BatchSource.h"
+#include "FlexNN.h"
+#include "Layer.h"
+
+namespace FlexNN
+{
+  /**
+   * @class AsyncEvaluator
+   * @brief Computes the validation accuracy of snapshots of a network on a background thread.
+   *
+   * The weights are double-buffered: submit() copies only the weights and biases of the layers
+   * (not their optimizer state) into a free snapshot network, reusing its buffers so steady-state
+   * submissions do not allocate, and returns at once while the worker thread evaluates the
+   * oldest pending snapshot. submit() only waits if both snapshots are still in use, i.e. when
+   * validation falls more than one evaluation behind.
+   * Results are handed to the validation callback on the worker thread, in submission order.
+   *
+   * finish() waits for the pending evaluations and rethrows the first exception of the worker,
+   * if any; the destructor stops the worker without waiting for them.
+   *
+   * @tparam Scalar The floating point type of the weights and activations (float or double).
+   */
+  template <typename Scalar>
+  class AsyncEvaluator
+  {
+  public:
+    /**
+     * @brief Constructor for the AsyncEvaluator class, starting the worker thread.
+     *
+     * @param layers The layers of the network, used to size the snapshots.
+     * @param source The source of the validation samples, which must outlive the evaluator.
+     * @param maxSamples The number of samples evaluated, 0 for all of them.
+     * @param callback The function receiving the epoch and accuracy of every evaluation.
+     */
+    AsyncEvaluator(const std::vector<BasicLayer<Scalar>> &layers, BatchSource<Scalar> &source, long maxSamples, const ValidationCallback &callback)
+        : source(source), maxSamples(maxSamples), callback(callback), snapshots(2, BasicNeuralNetwork<Scalar>(parametersOf(layers))),
+          epochs(2, 0), head(0), pending(0), stopping(false)
+    {
+      worker = std::thread(&AsyncEvaluator::run, this);
+    }
+
+    /**
+     * @brief Stop and join the worker thread, dropping the evaluations that did not start yet.
+     */
+    ~AsyncEvaluator()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      changed.notify_all();
+      if (worker.joinable())
+        worker.join();
+    }
+
+    AsyncEvaluator(const AsyncEvaluator &) = delete;
+    AsyncEvaluator &operator=(const AsyncEvaluator &) = delete;
+
+    /**
+     * @brief Queue an evaluation of the current weights.
+     *
+     * @param epoch The number of the epoch the weights are taken after, passed to the callback.
+     * @param layers The layers of the network to snapshot.
+     * @throws Any exception thrown by an earlier evaluation or by the callback.
+     */
+    void submit(int epoch, const std::vector<BasicLayer<Scalar>> &layers)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this]
+                   { return pending < snapshots.size() || error; });
+      if (error)
+        std::rethrow_exception(error); // The worker has stopped, report its failure to the training loop
+      const size_t slot = (head + pending) % snapshots.size();
+      lock.unlock();
+
+      for (size_t i = 0; i < layers.size(); ++i) // Copies into the buffers of the free snapshot, the worker never reads it meanwhile
+        snapshots[slot].layers[i].copyParameters(layers[i]);
+      epochs[slot] = epoch;
+
+      lock.lock();
+      ++pending;
+      lock.unlock();
+      changed.notify_all();
+    }
+
+    /**
+     * @brief Wait for the queued evaluations and stop the worker thread.
+     *
+     * @throws Any exception thrown while evaluating or by the callback.
+     */
+    void finish()
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]
+                     { return pending == 0 || error; });
+        stopping = true;
+      }
+      changed.notify_all();
+      worker.join();
+      if (error)
+        std::rethrow_exception(error);
+    }
+
+  private:
+    /**
+     * @brief Copies of the layers of a network without their optimizer state, to build the snapshots from.
+     *
+     * The copies are made without random weights, which would only be overwritten and would
+     * advance the std::rand() stream the layers of the caller are initialized from.
+     */
+    static std::vector<BasicLayer<Scalar>> parametersOf(const std::vector<BasicLayer<Scalar>> &layers)
+    {
+      std::vector<BasicLayer<Scalar>> copies;
+      for (const auto &layer : layers)
+      {
+        copies.push_back(BasicLayer<Scalar>(layer.getInputSize(), layer.getOutputSize(), layer.getActivation(), nullptr, nullptr, nullptr));
+        copies.back().copyParameters(layer);
+      }
+      return copies;
+    }
+
+    /**
+     * @brief Body of the worker thread.
+     */
+    void run()
+    {
+      for (;;)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]
+                     { return stopping || pending > 0; });
+        if (stopping || error)
+          return;
+        const size_t slot = head;
+        lock.unlock();
+
+        try
+        {
+          const double accuracy = snapshots[slot].accuracy(source, 1024, maxSamples);
+          if (callback)
+            callback(epochs[slot], accuracy);
+        }
+        catch (...)
+        {
+          lock.lock();
+          error = std::current_exception();
+          lock.unlock();
+        }
+
+        lock.lock();
+        head = (head + 1) % snapshots.size();
+        --pending;
+        lock.unlock();
+        changed.notify_all();
+      }
+    }
+
+    /**
+     * @brief The source of the validation samples.
+     */
+    BatchSource<Scalar> &source;
+    /**
+     * @brief Number of samples evaluated, 0 for all of them.
+     */
+    const long maxSamples;
+    /**
+     * @brief Function receiving the result of every evaluation.
+     */
+    const ValidationCallback callback;
+    /**
+     * @brief The double-buffered snapshots of the network.
+     */
+    std::vector<BasicNeuralNetwork<Scalar>> snapshots;
+    /**
+     * @brief Epoch of the weights held by every snapshot.
+     */
+    std::vector<int> epochs;
+    /**
+     * @brief Index of the oldest pending snapshot.
+     */
+    size_t head;
+    /**
+     * @brief Number of snapshots queued or being evaluated.
+     */
+    size_t pending;
+    /**
+     * @brief Whether the worker thread should exit.
+     */
+    bool stopping;
+    /**
+     * @brief First exception thrown by an evaluation or the callback.
+     */
+    std::exception_ptr error;
+    /**
+     * @brief Guards the queue indices and flags.
+     */
+    std::mutex mutex;
+    /**
+     * @brief Signals every change of the queue indices and flags.
+     */
+    std::condition_variable changed;
+    /**
+     * @brief The worker thread.
+     */
+    std::thread worker;
+  };
+}
+
+#endif // FlexNN_AsyncEvaluator_H
@@ -0,0 +1,85 @@
+/**
+ * @file AtomicFile.h
+ * @brief Internal helpers for writing and checking the binary files of the FlexNN neural network library.
+ *
+ * This file holds the steps shared by the binary formats (dataset and model files): laying out and
+ * padding aligned arrays, checking that the arrays of a mapped file lie inside it, and replacing the
+ * target atomically once a file has been written under a temporary name. It is not part of the
+ * public headers.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_AtomicFile_H
+#define FlexNN_AtomicFile_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace FlexNN
+{
+  /**
+   * @brief Round an offset up to a multiple of an alignment.
+   */
+  inline uint64_t alignUp(uint64_t offset, uint64_t alignment)
+  {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  /**
+   * @brief Write zero bytes up to an offset.
+   */
+  inline void padTo(std::ofstream &out, uint64_t offset)
+  {
+    static const char zeros[64] = {};
+    for (uint64_t position = static_cast<uint64_t>(out.tellp()); out && position < offset;)
+    {
+      const uint64_t count = std::min<uint64_t>(offset - position, sizeof(zeros));
+      out.write(zeros, static_cast<std::streamsize>(count));
+      position += count;
+    }
+  }
+
+  /**
+   * @brief Check that an array of `count` elements at an offset lies inside a file.
+   *
+   * The sizes are compared by division, so corrupt counts read from a file cannot overflow the
+   * products.
+   *
+   * @param offset The offset of the array from the start of the file.
+   * @param count The number of elements of the array.
+   * @param elementSize The size of one element in bytes, greater than 0.
+   * @param fileSize The size of the file in bytes.
+   */
+  inline bool fitsIn(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize)
+  {
+    return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+  }
+
+  /**
+   * @brief Finish a file written under a temporary name and rename it over the target.
+   *
+   * Only a complete file ever appears under the final name, and mappings of the file it replaces
+   * stay valid. On failure the temporary file is removed.
+   *
+   * @param out The stream the file was written with, which is closed.
+   * @param temporary The path the file was written to.
+   * @param filename The path to move the file to.
+   * @throws std::runtime_error If the file could not be written or renamed.
+   */
+  inline void commitFile(std::ofstream &out, const std::string &temporary, const std::string &filename)
+  {
+    const bool written = static_cast<bool>(out.flush());
+    out.close();
+    if (!written || std::rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+      std::remove(temporary.c_str());
+      throw std::runtime_error("Could not write " + filename);
+    }
+  }
+}
+
+#endif // FlexNN_AtomicFile_H
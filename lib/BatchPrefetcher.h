@@ -0,0 +1,262 @@
+/**
+ * @file BatchPrefetcher.h
+ * @brief Internal background batch pipeline of the FlexNN neural network library.
+ *
+ * This file defines the BatchPrefetcher class, which reads mini-batches from a BatchSource on a
+ * producer thread while the caller computes on the previous ones. It is used by the training and
+ * evaluation loops and is not part of the public headers.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_BatchPrefetcher_H
+#define FlexNN_BatchPrefetcher_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "BatchSource.h"
+
+namespace FlexNN
+{
+  /**
+   * @class BatchPrefetcher
+   * @brief Reads mini-batches from a BatchSource on a background thread, into a ring of preallocated slots.
+   *
+   * The producer thread fills the slots in order while the consumer works on the oldest filled
+   * one, so gathering, converting and checking batch k + 1 overlaps the forward and backward
+   * passes of batch k. The ring is a bounded queue: with the default depth of two (double
+   * buffering) the producer runs at most one batch ahead, and waits for a slot to be released
+   * before reading further. Nothing is allocated after construction.
+   *
+   * Every pass over the source is requested with start() and consumed with acquire() and
+   * release() until acquire() returns nullptr. An exception thrown by the source is rethrown by
+   * acquire() on the consumer thread.
+   *
+   * @tparam Scalar The floating point type of the batches (float or double).
+   */
+  template <typename Scalar>
+  class BatchPrefetcher
+  {
+  public:
+    /**
+     * @brief Matrix type of the batch buffers.
+     */
+    typedef Eigen::MatrixX<Scalar> Matrix;
+
+    /**
+     * @brief One preallocated batch of the ring.
+     */
+    struct Slot
+    {
+      Matrix X;          ///< Features, one column per sample.
+      Eigen::VectorXi Y; ///< Class labels.
+      int size;          ///< Number of samples in the leading columns, 0 for the end of a pass.
+    };
+
+    /**
+     * @brief Constructor for the BatchPrefetcher class, starting the producer thread.
+     *
+     * @param source The source to read the batches from, which must outlive the prefetcher.
+     * @param batchSize The maximum number of samples in a batch.
+     * @param classes The number of classes the labels are checked against, or 0 to skip the check.
+     * @param depth The number of slots in the ring.
+     */
+    BatchPrefetcher(BatchSource<Scalar> &source, int batchSize, int classes = 0, int depth = 2)
+        : source(source), classes(classes), slots(std::max(2, depth)), head(0), tail(0), filled(0), running(false), stopping(false)
+    {
+      for (Slot &slot : slots)
+      {
+        slot.X.resize(source.getFeatureCount(), batchSize);
+        slot.Y.resize(batchSize);
+        slot.size = 0;
+      }
+      producer = std::thread(&BatchPrefetcher::produce, this);
+    }
+
+    /**
+     * @brief Stop and join the producer thread.
+     */
+    ~BatchPrefetcher()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      changed.notify_all();
+      producer.join();
+    }
+
+    BatchPrefetcher(const BatchPrefetcher &) = delete;
+    BatchPrefetcher &operator=(const BatchPrefetcher &) = delete;
+
+    /**
+     * @brief Start a new pass over the source.
+     *
+     * Must only be called once the previous pass has been consumed to its end, when the producer
+     * is idle and the source can safely be reset from the calling thread.
+     *
+     * @param shuffle Whether the source visits its samples in a new random order.
+     */
+    void start(bool shuffle)
+    {
+      source.reset(shuffle);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = true;
+      }
+      changed.notify_all();
+    }
+
+    /**
+     * @brief Wait for the next batch of the current pass.
+     *
+     * @return The oldest filled slot, to be handed back with release(), or nullptr at the end of the pass.
+     */
+    const Slot *acquire()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this]
+                   { return filled > 0; });
+      const Slot &slot = slots[head];
+      if (slot.size > 0)
+        return &slot;
+
+      // End of the pass (or a failure), consume the marker
+      head = (head + 1) % slots.size();
+      --filled;
+      if (error)
+      {
+        std::exception_ptr failure = error;
+        error = nullptr;
+        std::rethrow_exception(failure);
+      }
+      return nullptr;
+    }
+
+    /**
+     * @brief Hand the slot returned by the last acquire() back to the producer.
+     */
+    void release()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        head = (head + 1) % slots.size();
+        --filled;
+      }
+      changed.notify_all();
+    }
+
+  private:
+    /**
+     * @brief Body of the producer thread.
+     */
+    void produce()
+    {
+      for (;;)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]
+                     { return stopping || (running && filled < slots.size()); });
+        if (stopping)
+          return;
+        Slot &slot = slots[tail];
+        lock.unlock();
+
+        // Read and check the batch without holding the lock, the consumer never touches this slot meanwhile
+        try
+        {
+          slot.size = source.read(slot.X, slot.Y);
+          if (classes > 0)
+            check(slot);
+        }
+        catch (...)
+        {
+          slot.size = 0; // Ends the pass, acquire() rethrows the error
+          lock.lock();
+          error = std::current_exception();
+          lock.unlock();
+        }
+
+        lock.lock();
+        tail = (tail + 1) % slots.size();
+        ++filled;
+        if (slot.size == 0)
+          running = false; // The pass is over, wait for the next start()
+        lock.unlock();
+        changed.notify_all();
+      }
+    }
+
+    /**
+     * @brief Check that the labels of a slot are classes of the output layer.
+     *
+     * @throws std::out_of_range If a label is not one of the classes.
+     */
+    void check(const Slot &slot) const
+    {
+      for (int i = 0; i < slot.size; ++i)
+      {
+        if (slot.Y(i) < 0 || slot.Y(i) >= classes)
+          throw std::out_of_range("Label " + std::to_string(slot.Y(i)) + " is not a class of the output layer");
+      }
+    }
+
+    /**
+     * @brief The source the batches are read from.
+     */
+    BatchSource<Scalar> &source;
+    /**
+     * @brief Number of classes the labels are checked against, 0 for none.
+     */
+    const int classes;
+    /**
+     * @brief The ring of batches.
+     */
+    std::vector<Slot> slots;
+    /**
+     * @brief Index of the oldest filled slot, the next one acquire() returns.
+     */
+    size_t head;
+    /**
+     * @brief Index of the next slot the producer fills.
+     */
+    size_t tail;
+    /**
+     * @brief Number of filled slots not yet released.
+     */
+    size_t filled;
+    /**
+     * @brief Whether a pass is in progress on the producer side.
+     */
+    bool running;
+    /**
+     * @brief Whether the producer thread should exit.
+     */
+    bool stopping;
+    /**
+     * @brief Exception thrown by the source, rethrown by acquire().
+     */
+    std::exception_ptr error;
+    /**
+     * @brief Guards the ring indices and flags.
+     */
+    std::mutex mutex;
+    /**
+     * @brief Signals every change of the ring indices and flags.
+     */
+    std::condition_variable changed;
+    /**
+     * @brief The producer thread.
+     */
+    std::thread producer;
+  };
+}
+
+#endif // FlexNN_BatchPrefetcher_H
@@ -0,0 +1,209 @@
+/**
+ * @file BatchSource.cpp
+ * @brief Source file for the batch sources in the FlexNN neural network library.
+ *
+ * This file defines MatrixBatchSource, a view of some samples of a matrix that is already in memory,
+ * and CSVStreamSource, which streams a CSV file of any size through a fixed-size buffer.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "BatchSource.h"
+#include "CSVParser.h"
+#include "Label.h"
+
+/**
+ * @brief Constructor for the MatrixBatchSource class.
+ *
+ * @param X The features, which must outlive the source.
+ * @param Y The labels, one per sample, which must outlive the source.
+ * @param indices The indices of the samples to read, in the order they are read until the first shuffle.
+ * @param layout The layout of X.
+ * @throws std::out_of_range If an index is not a sample of X and Y.
+ */
+template <typename Scalar>
+FlexNN::MatrixBatchSource<Scalar>::MatrixBatchSource(const Matrix &X, const Vector &Y, const std::vector<long> &indices, DataLayout layout)
+    : features(&X), labels(&Y), indices(indices), layout(layout), position(0), rng(std::random_device{}())
+{
+  const long samples = std::min<long>(layout == DataLayout::FeaturesBySamples ? X.cols() : X.rows(), Y.size());
+  for (long index : indices)
+  {
+    if (index < 0 || index >= samples)
+      throw std::out_of_range("Sample index " + std::to_string(index) + " is out of range");
+  }
+}
+
+/**
+ * @brief Start a new pass over the samples.
+ *
+ * @param shuffle Whether to visit the samples in a new random order.
+ */
+template <typename Scalar>
+void FlexNN::MatrixBatchSource<Scalar>::reset(bool shuffle)
+{
+  if (shuffle)
+    std::shuffle(indices.begin(), indices.end(), rng);
+  position = 0;
+}
+
+/**
+ * @brief Read the next samples of the current pass.
+ *
+ * @param X The buffer to store the features in, one column per sample. At most X.cols() samples are read.
+ * @param Y The buffer to store the class labels in, with at least X.cols() entries.
+ * @return int The number of samples read into the leading columns of X, or 0 at the end of the pass.
+ * @throws std::invalid_argument If a stored label is not a finite value in the range of int.
+ */
+template <typename Scalar>
+int FlexNN::MatrixBatchSource<Scalar>::read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y)
+{
+  const long count = std::min<long>(X.cols(), indices.size() - position);
+  for (long i = 0; i < count; ++i)
+  {
+    const long index = indices[position + i];
+    if (layout == DataLayout::FeaturesBySamples)
+      X.col(i) = features->col(index); // A sample is a contiguous column
+    else
+      X.col(i) = features->row(index).transpose();
+    Y(i) = toLabel(static_cast<double>((*labels)(index)));
+  }
+  position += count;
+  return static_cast<int>(count);
+}
+
+/**
+ * @brief Constructor for the CSVStreamSource class.
+ *
+ * Opens the file and reads its first row to find the number of features.
+ *
+ * @param filename The path to the CSV file to read.
+ * @param scale The factor every feature is multiplied by.
+ * @param bufferSize The size of the read buffer in bytes.
+ * @throws std::runtime_error If the file cannot be opened or has no data rows.
+ */
+template <typename Scalar>
+FlexNN::CSVStreamSource<Scalar>::CSVStreamSource(const std::string &filename, Scalar scale, size_t bufferSize)
+    : filename(filename), file(filename, std::ios::binary), scale(scale), features(0), row(0),
+      buffer(std::max<size_t>(bufferSize, 1)), begin(0), end(0), eof(false)
+{
+  if (!file)
+    throw std::runtime_error("Could not open " + filename);
+
+  rewind();
+  const char *line, *stop;
+  do
+  {
+    if (!nextLine(line, stop))
+      throw std::runtime_error(filename + " has no data rows");
+  } while (csv::isBlankLine(line, stop));
+  features = std::count(line, stop, ','); // Every column but the label is a feature
+  rewind();
+}
+
+/**
+ * @brief Start a new pass over the file.
+ *
+ * @param shuffle Ignored, the rows of a stream are always read in file order.
+ */
+template <typename Scalar>
+void FlexNN::CSVStreamSource<Scalar>::reset(bool)
+{
+  rewind();
+}
+
+/**
+ * @brief Read the next rows of the file.
+ *
+ * @param X The buffer to store the features in, one column per sample. At most X.cols() samples are read.
+ * @param Y The buffer to store the class labels in, with at least X.cols() entries.
+ * @return int The number of samples read into the leading columns of X, or 0 at the end of the file.
+ * @throws std::invalid_argument If a stored label is not a finite value in the range of int.
+ * @throws std::runtime_error If a row is malformed.
+ */
+template <typename Scalar>
+int FlexNN::CSVStreamSource<Scalar>::read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y)
+{
+  int count = 0;
+  const char *line, *stop;
+  while (count < X.cols() && nextLine(line, stop))
+  {
+    if (csv::isBlankLine(line, stop))
+      continue;
+    ++row;
+    auto sample = X.col(count);
+    bool ok = csv::parseRow(line, stop, features + 1, [&](long j, double value)
+                            {
+                              if (j == 0)
+                                Y(count) = toLabel(value); // The label is the first column
+                              else
+                                sample(j - 1) = static_cast<Scalar>(value) * scale; // Scaled features
+                            });
+    if (!ok)
+      throw std::runtime_error("Malformed row " + std::to_string(row) + " in " + filename);
+    ++count;
+  }
+  return count;
+}
+
+/**
+ * @brief Move to the start of the first data row of the file.
+ */
+template <typename Scalar>
+void FlexNN::CSVStreamSource<Scalar>::rewind()
+{
+  file.clear();
+  file.seekg(0);
+  begin = end = 0;
+  eof = false;
+  row = 0;
+  const char *line, *stop;
+  nextLine(line, stop); // skip the header line
+}
+
+/**
+ * @brief Get the next line of the file, refilling the buffer as needed.
+ *
+ * @param line Receives the start of the line.
+ * @param stop Receives the end of the line (without the newline).
+ * @return Whether there was a line left.
+ */
+template <typename Scalar>
+bool FlexNN::CSVStreamSource<Scalar>::nextLine(const char *&line, const char *&stop)
+{
+  for (;;)
+  {
+    const char *newline = static_cast<const char *>(std::memchr(buffer.data() + begin, '\n', end - begin));
+    if (newline || (eof && begin < end))
+    {
+      line = buffer.data() + begin;
+      stop = newline ? newline : buffer.data() + end; // The last line may have no newline
+      begin = newline ? newline - buffer.data() + 1 : end;
+      return true;
+    }
+    if (eof)
+      return false;
+
+    // Keep the partial line at the front of the buffer and read more after it
+    std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+    if (end == buffer.size())
+      buffer.resize(2 * buffer.size()); // A single line does not fit, grow the buffer
+    file.read(buffer.data() + end, buffer.size() - end);
+    end += file.gcount();
+    eof = file.gcount() == 0;
+  }
+}
+
+template class FlexNN::MatrixBatchSource<float>;
+template class FlexNN::MatrixBatchSource<double>;
+template class FlexNN::CSVStreamSource<float>;
+template class FlexNN::CSVStreamSource<double>;
@@ -0,0 +1,213 @@
+/**
+ * @file CSVParser.h
+ * @brief Internal CSV parsing helpers of the FlexNN neural network library.
+ *
+ * This file holds the number and row parsers shared by the CSV loaders (readCSV_XY and
+ * CSVStreamSource). It is not part of the public headers.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_CSVParser_H
+#define FlexNN_CSVParser_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace FlexNN
+{
+  /**
+   * @namespace FlexNN::csv
+   * @brief Parsers for comma-separated numeric data held in memory.
+   *
+   * The parsers work on [begin, end) ranges that need not be null-terminated, such as a memory
+   * mapping or a read buffer.
+   */
+  namespace csv
+  {
+    /**
+     * @brief Powers of ten that are exactly representable as a double.
+     */
+    const double exactPowersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    /**
+     * @brief Whether a character ends the number of a cell (a separator, a blank or a line ending).
+     */
+    inline bool isCellEnd(char c)
+    {
+      return c == ',' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    /**
+     * @brief Parse the number at the start of [start, end) with std::strtod.
+     *
+     * @return A pointer past the characters strtod consumed, or nullptr if it consumed none.
+     */
+    inline const char *parseWithStrtod(const char *start, const char *end, double &value)
+    {
+      const size_t length = end - start;
+      char buffer[64]; // The input is not null-terminated, so copy the token for strtod
+      char *stop;
+      if (length >= sizeof(buffer))
+      {
+        const std::string token(start, length); // Rare, parse an over-long token from a heap copy
+        value = std::strtod(token.c_str(), &stop);
+        return stop == token.c_str() ? nullptr : start + (stop - token.c_str());
+      }
+      std::memcpy(buffer, start, length);
+      buffer[length] = '\0';
+      value = std::strtod(buffer, &stop);
+      return stop == buffer ? nullptr : start + (stop - buffer);
+    }
+
+    /**
+     * @brief Parse a decimal number at the start of a CSV cell.
+     *
+     * Numbers with up to 15 significant digits are accumulated as an integer and scaled by a single
+     * exact power of ten, which is correctly rounded; longer numbers fall back to std::strtod. So do
+     * tokens this parser does not understand, such as `nan`, `inf` or hexadecimal numbers, so a cell
+     * accepted by std::stod is still accepted. A trailing exponent marker without digits is ignored,
+     * as std::stod does.
+     *
+     * @param p The start of the cell.
+     * @param end The end of the line.
+     * @param value Receives the parsed number.
+     * @return A pointer past the number, or nullptr if the cell does not start with a number.
+     */
+    inline const char *parseNumber(const char *p, const char *end, double &value)
+    {
+      const char *start = p;
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+      uint64_t mantissa = 0;
+      int digits = 0, scale = 0;
+      bool any = false;
+      for (; p < end && static_cast<unsigned>(*p - '0') < 10; ++p, any = true)
+      {
+        if (digits < 19)
+        {
+          mantissa = mantissa * 10 + (*p - '0');
+          digits += mantissa != 0; // Leading zeros are not significant
+        }
+        else
+          ++scale; // Too many digits for the mantissa, the slow path takes over below
+      }
+      if (p < end && *p == '.')
+      {
+        for (++p; p < end && static_cast<unsigned>(*p - '0') < 10; ++p, any = true)
+        {
+          if (digits < 19)
+          {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+            --scale;
+          }
+        }
+      }
+      if (any && p < end && (*p == 'e' || *p == 'E'))
+      {
+        const char *q = p + 1;
+        bool negativeExponent = false;
+        if (q < end && (*q == '-' || *q == '+'))
+          negativeExponent = *q++ == '-';
+        int exponent = 0;
+        for (; q < end && static_cast<unsigned>(*q - '0') < 10; ++q)
+          exponent = std::min(exponent * 10 + (*q - '0'), 100000);
+        scale += negativeExponent ? -exponent : exponent;
+        p = q; // A bare exponent marker counts as an exponent of zero
+      }
+      if (!any || (p < end && !isCellEnd(*p)))
+      {
+        const char *stop = start; // Not a plain decimal number, let strtod try the whole token
+        while (stop < end && !isCellEnd(*stop))
+          ++stop;
+        return parseWithStrtod(start, stop, value);
+      }
+
+      if (digits <= 15 && scale >= -22 && scale <= 22) // Fast path, both operands are exact doubles
+      {
+        double magnitude = static_cast<double>(mantissa);
+        magnitude = scale < 0 ? magnitude / exactPowersOf10[-scale] : magnitude * exactPowersOf10[scale];
+        value = negative ? -magnitude : magnitude;
+        return p;
+      }
+      parseWithStrtod(start, p, value);
+      return p;
+    }
+
+    /**
+     * @brief Find the end of the line starting at p (the newline, or the end of the range).
+     */
+    inline const char *lineEnd(const char *p, const char *end)
+    {
+      const char *newline = static_cast<const char *>(std::memchr(p, '\n', end - p));
+      return newline ? newline : end;
+    }
+
+    /**
+     * @brief Find the start of the line after the one starting at p.
+     */
+    inline const char *nextLine(const char *p, const char *end)
+    {
+      const char *stop = lineEnd(p, end);
+      return stop == end ? end : stop + 1;
+    }
+
+    /**
+     * @brief Whether a line is empty (or only holds the carriage return of a CRLF line ending).
+     */
+    inline bool isBlankLine(const char *line, const char *stop)
+    {
+      return line == stop || (line + 1 == stop && *line == '\r');
+    }
+
+    /**
+     * @brief Skip the spaces and tabs at p.
+     */
+    inline const char *skipBlanks(const char *p, const char *end)
+    {
+      while (p < end && (*p == ' ' || *p == '\t'))
+        ++p;
+      return p;
+    }
+
+    /**
+     * @brief Parse one CSV row, handing every cell to a callback.
+     *
+     * Spaces and tabs around the numbers are ignored, as std::stod did.
+     *
+     * @param p The start of the line.
+     * @param end The end of the line.
+     * @param cols The number of cells the row must have.
+     * @param store Called with the index and value of every cell.
+     * @return Whether the row held exactly `cols` numeric cells.
+     */
+    template <typename Store>
+    bool parseRow(const char *p, const char *end, long cols, Store store)
+    {
+      for (long j = 0; j < cols; ++j)
+      {
+        double value;
+        p = parseNumber(skipBlanks(p, end), end, value);
+        if (!p)
+          return false;
+        p = skipBlanks(p, end);
+        store(j, value);
+        if (j + 1 < cols)
+        {
+          if (p == end || *p != ',') // Split by comma
+            return false;
+          ++p;
+        }
+      }
+      return p == end || *p == '\r';
+    }
+  }
+}
+
+#endif // FlexNN_CSVParser_H
@@ -0,0 +1,650 @@
+/**
+ * @file Dataset.cpp
+ * @brief Source file for the Dataset class in the FlexNN neural network library.
+ *
+ * This file defines the binary dataset format of the library and the Dataset class that reads it.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "AtomicFile.h"
+#include "Dataset.h"
+#include "Label.h"
+#include "MappedFile.h"
+
+namespace
+{
+  /**
+   * @brief Magic bytes at the start of every dataset file.
+   */
+  const char datasetMagic[8] = {'F', 'L', 'E', 'X', 'N', 'N', 'D', 'S'};
+
+  /**
+   * @brief Version of the dataset format written by this library.
+   */
+  const uint32_t datasetVersion = 1;
+
+  /**
+   * @brief Alignment of the arrays in a dataset file, one cache line.
+   */
+  const uint64_t datasetAlignment = 64;
+
+  /**
+   * @brief Layout of the header of a dataset file.
+   */
+  struct DatasetHeader
+  {
+    char magic[8];          // "FLEXNNDS"
+    uint32_t version;       // Format version
+    uint32_t featureType;   // DataType of the features
+    uint32_t labelType;     // DataType of the labels
+    uint32_t reserved;      // Zero
+    uint64_t samples;       // Number of samples
+    uint64_t features;      // Number of features of each sample
+    uint64_t featureOffset; // Offset of the (features, samples) feature matrix from the start of the file
+    uint64_t labelOffset;   // Offset of the label vector from the start of the file
+    double featureScale;    // Factor the stored features are multiplied by when they are gathered
+  };
+  static_assert(sizeof(DatasetHeader) == 64, "The dataset header must be 64 bytes");
+
+  /**
+   * @brief The DataType a scalar type is stored as.
+   */
+  template <typename Scalar>
+  struct DataTypeOf;
+
+  template <>
+  struct DataTypeOf<float>
+  {
+    static const FlexNN::DataType value = FlexNN::DataType::Float32;
+  };
+
+  template <>
+  struct DataTypeOf<double>
+  {
+    static const FlexNN::DataType value = FlexNN::DataType::Float64;
+  };
+
+  template <>
+  struct DataTypeOf<uint8_t>
+  {
+    static const FlexNN::DataType value = FlexNN::DataType::UInt8;
+  };
+
+  template <>
+  struct DataTypeOf<uint16_t>
+  {
+    static const FlexNN::DataType value = FlexNN::DataType::UInt16;
+  };
+
+  template <>
+  struct DataTypeOf<int32_t>
+  {
+    static const FlexNN::DataType value = FlexNN::DataType::Int32;
+  };
+
+  /**
+   * @brief Size in bytes of one element of a DataType, or 0 for an unknown type.
+   */
+  uint64_t sizeOf(uint32_t type)
+  {
+    switch (static_cast<FlexNN::DataType>(type))
+    {
+    case FlexNN::DataType::UInt8:
+      return 1;
+    case FlexNN::DataType::UInt16:
+      return 2;
+    case FlexNN::DataType::Float32:
+    case FlexNN::DataType::Int32:
+      return 4;
+    case FlexNN::DataType::Float64:
+      return 8;
+    default:
+      return 0;
+    }
+  }
+
+  /**
+   * @brief Check that a dataset header is valid and that both arrays lie inside the file.
+   *
+   * @throws std::runtime_error If the header is not valid.
+   */
+  void validateHeader(const DatasetHeader &header, uint64_t fileSize, const std::string &filename)
+  {
+    if (std::memcmp(header.magic, datasetMagic, sizeof(datasetMagic)) != 0)
+      throw std::runtime_error(filename + " is not a dataset file");
+    if (header.version != datasetVersion)
+      throw std::runtime_error(filename + " has unsupported dataset version " + std::to_string(header.version));
+
+    const uint64_t featureSize = sizeOf(header.featureType);
+    const uint64_t labelSize = sizeOf(header.labelType);
+    if (featureSize == 0 || labelSize == 0)
+      throw std::runtime_error(filename + " has an unknown element type");
+    if (static_cast<FlexNN::DataType>(header.featureType) == FlexNN::DataType::Int32)
+      throw std::runtime_error(filename + " has Int32 features, which is only a label type");
+    if (header.featureOffset % datasetAlignment != 0 || header.labelOffset % datasetAlignment != 0)
+      throw std::runtime_error(filename + " has misaligned arrays");
+
+    // A sample is checked to fit before it is used as the element size of the feature array
+    const bool fits = FlexNN::fitsIn(header.featureOffset, header.features, featureSize, fileSize) &&
+                      (header.features == 0 || FlexNN::fitsIn(header.featureOffset, header.samples, featureSize * header.features, fileSize)) &&
+                      FlexNN::fitsIn(header.labelOffset, header.samples, labelSize, fileSize);
+    if (!fits)
+      throw std::runtime_error(filename + " is truncated or corrupt");
+  }
+
+  /**
+   * @brief Fill in the header of a dataset file, with both arrays aligned after it.
+   */
+  DatasetHeader makeHeader(FlexNN::DataType featureType, FlexNN::DataType labelType, uint64_t samples, uint64_t features, double scale)
+  {
+    DatasetHeader header = {};
+    std::memcpy(header.magic, datasetMagic, sizeof(datasetMagic));
+    header.version = datasetVersion;
+    header.featureType = static_cast<uint32_t>(featureType);
+    header.labelType = static_cast<uint32_t>(labelType);
+    header.samples = samples;
+    header.features = features;
+    header.featureOffset = FlexNN::alignUp(sizeof(header), datasetAlignment);
+    header.labelOffset = FlexNN::alignUp(header.featureOffset + sizeOf(header.featureType) * features * samples, datasetAlignment);
+    header.featureScale = scale;
+    return header;
+  }
+
+  /**
+   * @brief Convert a CSV file to a dataset file chunk by chunk, in bounded memory.
+   *
+   * The features are written to the dataset file as the rows are read, and the labels to a side file
+   * that is appended once the number of samples, and so the offset of the labels, is known.
+   */
+  template <typename Stored, typename Label>
+  void convertCSV(const std::string &csvFilename, const std::string &filename, double scale)
+  {
+    const bool integer = std::numeric_limits<Stored>::is_integer;
+    FlexNN::CSVStreamSource<double> source(csvFilename, integer ? 1.0 : scale); // Integer features are stored as they are
+    const long features = source.getFeatureCount();
+    const long chunkSamples = std::max(1L, (1L << 21) / std::max(1L, features)); // About 16 MB of parsed features
+    Eigen::MatrixXd X(features, chunkSamples);
+    Eigen::VectorXi Y(chunkSamples);
+    Eigen::MatrixX<Stored> storedX(features, chunkSamples);
+    Eigen::VectorX<Label> storedY(chunkSamples);
+    const double maxFeature = static_cast<double>(std::numeric_limits<Stored>::max());
+
+    const std::string temporary = filename + ".tmp";
+    const std::string labelTemporary = filename + ".labels.tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    std::fstream labels(labelTemporary, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    try
+    {
+      if (!out || !labels)
+        throw std::runtime_error("Could not create " + temporary);
+      DatasetHeader header = makeHeader(DataTypeOf<Stored>::value, DataTypeOf<Label>::value, 0, features, 1.0);
+      FlexNN::padTo(out, header.featureOffset); // The header is written last, once the number of samples is known
+
+      uint64_t samples = 0;
+      while (const int count = source.read(X, Y))
+      {
+        auto chunk = X.leftCols(count);
+        if (integer && !(chunk.array() >= 0.0 && chunk.array() <= maxFeature && chunk.array() == chunk.array().round()).all())
+          throw std::runtime_error(csvFilename + " has features that do not fit the integer feature type");
+        storedX.leftCols(count) = chunk.template cast<Stored>();
+        storedY.head(count) = Y.head(count).template cast<Label>();
+        out.write(reinterpret_cast<const char *>(storedX.data()), static_cast<std::streamsize>(sizeof(Stored) * features * count));
+        labels.write(reinterpret_cast<const char *>(storedY.data()), static_cast<std::streamsize>(sizeof(Label) * count));
+        samples += count;
+      }
+
+      header = makeHeader(DataTypeOf<Stored>::value, DataTypeOf<Label>::value, samples, features, integer ? scale : 1.0);
+      FlexNN::padTo(out, header.labelOffset);
+      labels.seekg(0);
+      std::vector<char> buffer(1 << 20);
+      while (labels.read(buffer.data(), buffer.size()) || labels.gcount() > 0)
+        out.write(buffer.data(), labels.gcount());
+      if (!labels.eof())
+        throw std::runtime_error("Could not write " + filename);
+      out.seekp(0);
+      out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+    catch (...)
+    {
+      out.close();
+      labels.close();
+      std::remove(temporary.c_str());
+      std::remove(labelTemporary.c_str());
+      throw;
+    }
+    labels.close();
+    std::remove(labelTemporary.c_str());
+    FlexNN::commitFile(out, temporary, filename);
+  }
+
+  /**
+   * @brief Convert the features of samples stored as a given type into a floating point batch.
+   */
+  template <typename Stored, typename Scalar>
+  void gatherFeatures(const char *data, long rows, const long *indices, long count, Scalar scale, Eigen::Ref<Eigen::MatrixX<Scalar>> X)
+  {
+    const Stored *features = reinterpret_cast<const Stored *>(data);
+    for (long i = 0; i < count; ++i)
+    {
+      Eigen::Map<const Eigen::VectorX<Stored>> column(features + indices[i] * rows, rows);
+      X.col(i) = column.template cast<Scalar>() * scale; // Convert and scale in one pass
+    }
+  }
+
+  /**
+   * @brief Convert the labels of samples stored as a given type into integer classes.
+   */
+  template <typename Stored>
+  void gatherLabels(const char *data, const long *indices, long count, Eigen::Ref<Eigen::VectorXi> Y)
+  {
+    const Stored *labels = reinterpret_cast<const Stored *>(data);
+    for (long i = 0; i < count; ++i)
+      Y(i) = FlexNN::toLabel(static_cast<double>(labels[indices[i]]));
+  }
+
+  /**
+   * @brief Convert samples of features and labels stored as any DataType into a floating point batch.
+   */
+  template <typename Scalar>
+  void gatherBatch(FlexNN::DataType featureType, const char *featureData, FlexNN::DataType labelType, const char *labelData, long rows,
+                   const long *indices, long count, Scalar scale, Eigen::Ref<Eigen::MatrixX<Scalar>> X, Eigen::Ref<Eigen::VectorXi> Y)
+  {
+    switch (featureType)
+    {
+    case FlexNN::DataType::Float32:
+      gatherFeatures<float>(featureData, rows, indices, count, scale, X);
+      break;
+    case FlexNN::DataType::Float64:
+      gatherFeatures<double>(featureData, rows, indices, count, scale, X);
+      break;
+    case FlexNN::DataType::UInt8:
+      gatherFeatures<uint8_t>(featureData, rows, indices, count, scale, X);
+      break;
+    case FlexNN::DataType::UInt16:
+      gatherFeatures<uint16_t>(featureData, rows, indices, count, scale, X);
+      break;
+    case FlexNN::DataType::Int32: // Only a label type, rejected by validateHeader
+      break;
+    }
+    switch (labelType)
+    {
+    case FlexNN::DataType::Float32:
+      gatherLabels<float>(labelData, indices, count, Y);
+      break;
+    case FlexNN::DataType::Float64:
+      gatherLabels<double>(labelData, indices, count, Y);
+      break;
+    case FlexNN::DataType::UInt8:
+      gatherLabels<uint8_t>(labelData, indices, count, Y);
+      break;
+    case FlexNN::DataType::UInt16:
+      gatherLabels<uint16_t>(labelData, indices, count, Y);
+      break;
+    case FlexNN::DataType::Int32:
+      gatherLabels<int32_t>(labelData, indices, count, Y);
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Open a dataset file.
+ *
+ * Maps the file and checks that the header is valid and that both arrays lie inside the file.
+ *
+ * @param filename The path to the dataset file.
+ * @throws std::runtime_error If the file cannot be mapped or is not a valid dataset file.
+ */
+FlexNN::Dataset::Dataset(const std::string &filename) : file(std::make_shared<MappedFile>(filename))
+{
+  DatasetHeader header;
+  if (file->size() < sizeof(header))
+    throw std::runtime_error(filename + " is not a dataset file");
+  std::memcpy(&header, file->data(), sizeof(header));
+  validateHeader(header, file->size(), filename);
+
+  samples = static_cast<long>(header.samples);
+  featureCount = static_cast<long>(header.features);
+  featureType = static_cast<DataType>(header.featureType);
+  labelType = static_cast<DataType>(header.labelType);
+  featureScale = header.featureScale;
+  featureData = file->data() + header.featureOffset;
+  labelData = file->data() + header.labelOffset;
+}
+
+/**
+ * @brief Construct a view of arrays stored in memory-mapped files, for the readers of other formats.
+ *
+ * @param featureFile The mapping holding the features.
+ * @param featureData Start of the (features, samples) feature matrix in featureFile.
+ * @param featureType Element type of the features.
+ * @param featureCount Number of features of each sample.
+ * @param labelFile The mapping holding the labels, which may be featureFile.
+ * @param labelData Start of the label vector in labelFile.
+ * @param labelType Element type of the labels.
+ * @param samples Number of samples.
+ * @param featureScale Factor the stored features are multiplied by when they are gathered.
+ */
+FlexNN::Dataset::Dataset(std::shared_ptr<MappedFile> featureFile, const char *featureData, DataType featureType, long featureCount,
+                         std::shared_ptr<MappedFile> labelFile, const char *labelData, DataType labelType, long samples, double featureScale)
+    : file(std::move(featureFile)), labelFile(std::move(labelFile)), samples(samples), featureCount(featureCount),
+      featureType(featureType), labelType(labelType), featureScale(featureScale), featureData(featureData), labelData(labelData)
+{
+}
+
+/**
+ * @brief Write features and labels to a dataset file.
+ *
+ * The file is written under a temporary name and renamed over the target once it is complete,
+ * so an interrupted conversion never leaves a truncated dataset file behind.
+ *
+ * @param filename The path to the dataset file to create (or overwrite).
+ * @param X The features, in the form (features, samples).
+ * @param Y The labels, one per sample.
+ * @param scale The feature scale recorded in the header, the factor gather() multiplies the features by.
+ * @throws std::invalid_argument If X and Y do not have the same number of samples.
+ * @throws std::runtime_error If the file cannot be written.
+ */
+template <typename Feature, typename Label>
+void FlexNN::Dataset::write(const std::string &filename, const Eigen::MatrixX<Feature> &X, const Eigen::VectorX<Label> &Y, double scale)
+{
+  if (X.cols() != Y.size())
+    throw std::invalid_argument("Features and labels must have the same number of samples");
+
+  const DatasetHeader header = makeHeader(DataTypeOf<Feature>::value, DataTypeOf<Label>::value, X.cols(), X.rows(), scale);
+  const std::string temporary = filename + ".tmp";
+  std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("Could not create " + temporary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  padTo(out, header.featureOffset);
+  out.write(reinterpret_cast<const char *>(X.data()), static_cast<std::streamsize>(sizeof(Feature) * X.size()));
+  padTo(out, header.labelOffset);
+  out.write(reinterpret_cast<const char *>(Y.data()), static_cast<std::streamsize>(sizeof(Label) * Y.size()));
+  commitFile(out, temporary, filename);
+}
+
+/**
+ * @brief Convert a CSV file to a dataset file.
+ *
+ * The CSV file is streamed in chunks that are written out as they are read, so files far larger
+ * than the memory of the machine can be converted. The labels are read as integer classes.
+ *
+ * @param csvFilename The path to the CSV file to read.
+ * @param filename The path to the dataset file to create (or overwrite).
+ * @param featureType The type to store the features as.
+ * @param scale The factor every feature is multiplied by.
+ * @throws std::invalid_argument If featureType is Int32, which is only used for labels.
+ * @throws std::runtime_error If a file cannot be read or written, a row is malformed, or a
+ * value does not fit the integer feature type.
+ */
+void FlexNN::Dataset::fromCSV(const std::string &csvFilename, const std::string &filename, DataType featureType, double scale)
+{
+  switch (featureType)
+  {
+  case DataType::Float32:
+    convertCSV<float, float>(csvFilename, filename, scale);
+    break;
+  case DataType::Float64:
+    convertCSV<double, double>(csvFilename, filename, scale);
+    break;
+  case DataType::UInt8:
+    convertCSV<uint8_t, int32_t>(csvFilename, filename, scale);
+    break;
+  case DataType::UInt16:
+    convertCSV<uint16_t, int32_t>(csvFilename, filename, scale);
+    break;
+  default:
+    throw std::invalid_argument("Features cannot be stored as this type");
+  }
+}
+
+/**
+ * @brief Get a view of the features as they are stored.
+ *
+ * @return A (features, samples) view of the features, pointing into the mapping.
+ * @throws std::runtime_error If the features are not stored as T.
+ */
+template <typename T>
+Eigen::Map<const Eigen::MatrixX<T>> FlexNN::Dataset::features() const
+{
+  if (featureType != DataTypeOf<T>::value)
+    throw std::runtime_error("The features of the dataset are stored as a different type");
+  return Eigen::Map<const Eigen::MatrixX<T>>(reinterpret_cast<const T *>(featureData), featureCount, samples);
+}
+
+/**
+ * @brief Get a view of the labels as they are stored.
+ *
+ * @return A view of the labels, one per sample, pointing into the mapping.
+ * @throws std::runtime_error If the labels are not stored as T.
+ */
+template <typename T>
+Eigen::Map<const Eigen::VectorX<T>> FlexNN::Dataset::labels() const
+{
+  if (labelType != DataTypeOf<T>::value)
+    throw std::runtime_error("The labels of the dataset are stored as a different type");
+  return Eigen::Map<const Eigen::VectorX<T>>(reinterpret_cast<const T *>(labelData), samples);
+}
+
+/**
+ * @brief Copy samples into a floating point batch.
+ *
+ * The features of each sample are converted to Scalar and multiplied by the feature scale,
+ * and its label is converted to an integer class.
+ *
+ * @param indices The indices of the samples to copy.
+ * @param count The number of samples to copy, at most X.cols().
+ * @param X The buffer to store the features in, one column per sample.
+ * @param Y The buffer to store the class labels in.
+ */
+template <typename Scalar>
+void FlexNN::Dataset::gather(const long *indices, long count, Eigen::Ref<Eigen::MatrixX<Scalar>> X, Eigen::Ref<Eigen::VectorXi> Y) const
+{
+  gatherBatch(featureType, featureData, labelType, labelData, featureCount, indices, count, static_cast<Scalar>(featureScale), X, Y);
+}
+
+/**
+ * @brief Constructor for the DatasetBatchSource class, reading every sample of a dataset.
+ *
+ * @param dataset The dataset to read, which shares its mapping with the source.
+ */
+template <typename Scalar>
+FlexNN::DatasetBatchSource<Scalar>::DatasetBatchSource(const Dataset &dataset)
+    : dataset(dataset), indices(dataset.getSampleCount()), position(0), rng(std::random_device{}())
+{
+  std::iota(indices.begin(), indices.end(), 0L);
+}
+
+/**
+ * @brief Constructor for the DatasetBatchSource class, reading some samples of a dataset.
+ *
+ * @param dataset The dataset to read, which shares its mapping with the source.
+ * @param indices The indices of the samples to read, in the order they are read until the first shuffle.
+ * @throws std::out_of_range If an index is not a sample of the dataset.
+ */
+template <typename Scalar>
+FlexNN::DatasetBatchSource<Scalar>::DatasetBatchSource(const Dataset &dataset, const std::vector<long> &indices)
+    : dataset(dataset), indices(indices), position(0), rng(std::random_device{}())
+{
+  for (long index : indices)
+  {
+    if (index < 0 || index >= dataset.getSampleCount())
+      throw std::out_of_range("Sample index " + std::to_string(index) + " is out of range");
+  }
+}
+
+/**
+ * @brief Start a new pass over the samples.
+ *
+ * @param shuffle Whether to visit the samples in a new random order.
+ */
+template <typename Scalar>
+void FlexNN::DatasetBatchSource<Scalar>::reset(bool shuffle)
+{
+  if (shuffle)
+    std::shuffle(indices.begin(), indices.end(), rng);
+  position = 0;
+}
+
+/**
+ * @brief Read the next samples of the current pass.
+ *
+ * @param X The buffer to store the features in, one column per sample. At most X.cols() samples are read.
+ * @param Y The buffer to store the class labels in, with at least X.cols() entries.
+ * @return int The number of samples read into the leading columns of X, or 0 at the end of the pass.
+ * @throws std::invalid_argument If a stored label is not a finite value in the range of int.
+ */
+template <typename Scalar>
+int FlexNN::DatasetBatchSource<Scalar>::read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y)
+{
+  const long count = std::min<long>(X.cols(), indices.size() - position);
+  dataset.gather<Scalar>(indices.data() + position, count, X, Y);
+  position += count;
+  return static_cast<int>(count);
+}
+
+/**
+ * @brief Constructor for the DatasetStreamSource class.
+ *
+ * @param filename The path to the dataset file.
+ * @param chunkSamples The number of samples read from the file at once.
+ * @throws std::runtime_error If the file cannot be opened or is not a valid dataset file.
+ */
+template <typename Scalar>
+FlexNN::DatasetStreamSource<Scalar>::DatasetStreamSource(const std::string &filename, long chunkSamples)
+    : filename(filename), file(filename, std::ios::binary), chunkSamples(std::max(1L, chunkSamples)), nextChunk(0), position(0),
+      shuffling(false), rng(std::random_device{}())
+{
+  if (!file)
+    throw std::runtime_error("Could not open " + filename);
+  file.seekg(0, std::ios::end);
+  const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+  file.seekg(0);
+
+  DatasetHeader header;
+  if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+    throw std::runtime_error(filename + " is not a dataset file");
+  validateHeader(header, fileSize, filename);
+
+  samples = static_cast<long>(header.samples);
+  featureCount = static_cast<long>(header.features);
+  featureType = static_cast<DataType>(header.featureType);
+  labelType = static_cast<DataType>(header.labelType);
+  featureScale = header.featureScale;
+  featureOffset = header.featureOffset;
+  labelOffset = header.labelOffset;
+
+  this->chunkSamples = std::min(this->chunkSamples, std::max(1L, samples));
+  chunkOrder.resize((samples + this->chunkSamples - 1) / this->chunkSamples);
+  std::iota(chunkOrder.begin(), chunkOrder.end(), 0L);
+  featureBuffer.resize(sizeOf(header.featureType) * featureCount * this->chunkSamples);
+  labelBuffer.resize(sizeOf(header.labelType) * this->chunkSamples);
+}
+
+/**
+ * @brief Start a new pass over the samples.
+ *
+ * @param shuffle Whether to visit the chunks, and the samples of each chunk, in a new random order.
+ */
+template <typename Scalar>
+void FlexNN::DatasetStreamSource<Scalar>::reset(bool shuffle)
+{
+  shuffling = shuffle;
+  if (shuffle)
+    std::shuffle(chunkOrder.begin(), chunkOrder.end(), rng);
+  nextChunk = 0;
+  chunkIndices.clear();
+  position = 0;
+}
+
+/**
+ * @brief Read the next samples of the current pass.
+ *
+ * @param X The buffer to store the features in, one column per sample. At most X.cols() samples are read.
+ * @param Y The buffer to store the class labels in, with at least X.cols() entries.
+ * @return int The number of samples read into the leading columns of X, or 0 at the end of the pass.
+ * @throws std::invalid_argument If a stored label is not a finite value in the range of int.
+ * @throws std::runtime_error If the file cannot be read.
+ */
+template <typename Scalar>
+int FlexNN::DatasetStreamSource<Scalar>::read(Eigen::Ref<Matrix> X, Eigen::Ref<Eigen::VectorXi> Y)
+{
+  long count = 0;
+  while (count < X.cols())
+  {
+    if (position == chunkIndices.size())
+    {
+      if (nextChunk == chunkOrder.size())
+        break; // End of the pass
+      loadChunk(chunkOrder[nextChunk++]);
+    }
+    const long size = std::min<long>(X.cols() - count, chunkIndices.size() - position);
+    gatherBatch<Scalar>(featureType, featureBuffer.data(), labelType, labelBuffer.data(), featureCount, chunkIndices.data() + position, size,
+                static_cast<Scalar>(featureScale), X.middleCols(count, size), Y.segment(count, size));
+    position += size;
+    count += size;
+  }
+  return static_cast<int>(count);
+}
+
+/**
+ * @brief Read a chunk of samples into the buffers.
+ */
+template <typename Scalar>
+void FlexNN::DatasetStreamSource<Scalar>::loadChunk(long chunk)
+{
+  const long first = chunk * chunkSamples;
+  const long size = std::min(chunkSamples, samples - first);
+  const uint64_t featureBytes = sizeOf(static_cast<uint32_t>(featureType)) * featureCount;
+  const uint64_t labelBytes = sizeOf(static_cast<uint32_t>(labelType));
+
+  file.clear();
+  file.seekg(featureOffset + featureBytes * first);
+  file.read(featureBuffer.data(), featureBytes * size);
+  file.seekg(labelOffset + labelBytes * first);
+  file.read(labelBuffer.data(), labelBytes * size);
+  if (!file)
+    throw std::runtime_error("Could not read " + filename);
+
+  chunkIndices.resize(size); // Positions of the samples within the chunk
+  std::iota(chunkIndices.begin(), chunkIndices.end(), 0L);
+  if (shuffling)
+    std::shuffle(chunkIndices.begin(), chunkIndices.end(), rng);
+  position = 0;
+}
+
+template void FlexNN::Dataset::write<float, float>(const std::string &, const Eigen::MatrixXf &, const Eigen::VectorXf &, double);
+template void FlexNN::Dataset::write<double, double>(const std::string &, const Eigen::MatrixXd &, const Eigen::VectorXd &, double);
+template void FlexNN::Dataset::write<uint8_t, int32_t>(const std::string &, const Eigen::MatrixX<uint8_t> &, const Eigen::VectorX<int32_t> &, double);
+template void FlexNN::Dataset::write<uint16_t, int32_t>(const std::string &, const Eigen::MatrixX<uint16_t> &, const Eigen::VectorX<int32_t> &, double);
+template Eigen::Map<const Eigen::MatrixXf> FlexNN::Dataset::features<float>() const;
+template Eigen::Map<const Eigen::MatrixXd> FlexNN::Dataset::features<double>() const;
+template Eigen::Map<const Eigen::MatrixX<uint8_t>> FlexNN::Dataset::features<uint8_t>() const;
+template Eigen::Map<const Eigen::MatrixX<uint16_t>> FlexNN::Dataset::features<uint16_t>() const;
+template Eigen::Map<const Eigen::VectorXf> FlexNN::Dataset::labels<float>() const;
+template Eigen::Map<const Eigen::VectorXd> FlexNN::Dataset::labels<double>() const;
+template Eigen::Map<const Eigen::VectorX<uint8_t>> FlexNN::Dataset::labels<uint8_t>() const;
+template Eigen::Map<const Eigen::VectorX<int32_t>> FlexNN::Dataset::labels<int32_t>() const;
+template void FlexNN::Dataset::gather<float>(const long *, long, Eigen::Ref<Eigen::MatrixXf>, Eigen::Ref<Eigen::VectorXi>) const;
+template void FlexNN::Dataset::gather<double>(const long *, long, Eigen::Ref<Eigen::MatrixXd>, Eigen::Ref<Eigen::VectorXi>) const;
+
+template class FlexNN::DatasetBatchSource<float>;
+template class FlexNN::DatasetBatchSource<double>;
+template class FlexNN::DatasetStreamSource<float>;
+template class FlexNN::DatasetStreamSource<double>;
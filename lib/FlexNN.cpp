@@ -8,37 +8,253 @@
  *
  * @author Nalin Angrish <nalin@nalinangrish.me>
  */
-#include <iostream>
+#include <cmath>
+#include <stdexcept>
+#include <string>
 #include <vector>
+#include <numeric>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
 #include <Eigen/Dense>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "FlexNN.h"
-#include "Utility.h"
+#include "AsyncEvaluator.h"
+#include "AtomicFile.h"
+#include "BatchPrefetcher.h"
+#include "Dataset.h"
+#include "Loss.h"
+#include "MappedFile.h"
+
+namespace
+{
+  /**
+   * @brief Magic bytes at the start of every model file.
+   */
+  const char modelMagic[8] = {'F', 'L', 'E', 'X', 'N', 'N', 'M', 'D'};
+
+  /**
+   * @brief Version of the model format written by this library.
+   */
+  const uint32_t modelVersion = 1;
+
+  /**
+   * @brief Alignment of the weights and biases in a model file, one cache line.
+   */
+  const uint64_t modelAlignment = 64;
+
+  /**
+   * @brief Layout of the header of a model file.
+   */
+  struct ModelHeader
+  {
+    char magic[8];        // "FLEXNNMD"
+    uint32_t version;     // Format version
+    uint32_t scalarType;  // DataType of the weights and biases, Float32 or Float64
+    uint32_t layers;      // Number of layers
+    uint32_t reserved;    // Zero
+    uint64_t layerOffset; // Offset of the layer table from the start of the file
+    uint64_t unused[4];   // Zero
+  };
+  static_assert(sizeof(ModelHeader) == 64, "The model header must be 64 bytes");
+
+  /**
+   * @brief Layout of an entry of the layer table of a model file.
+   */
+  struct ModelLayer
+  {
+    uint32_t inputSize;    // Number of inputs of the layer
+    uint32_t outputSize;   // Number of neurons of the layer
+    uint32_t activation;   // Activation of the layer
+    uint32_t reserved;     // Zero
+    uint64_t weightOffset; // Offset of the (outputSize, inputSize) weight matrix from the start of the file
+    uint64_t biasOffset;   // Offset of the bias vector from the start of the file
+  };
+  static_assert(sizeof(ModelLayer) == 32, "A model layer entry must be 32 bytes");
+
+  /**
+   * @brief Convert an array of a model file stored as another scalar type.
+   */
+  template <typename Stored, typename Scalar>
+  Eigen::MatrixX<Scalar> convertModel(const char *data, long rows, long cols)
+  {
+    return Eigen::Map<const Eigen::MatrixX<Stored>>(reinterpret_cast<const Stored *>(data), rows, cols).template cast<Scalar>();
+  }
+}
 
 /**
  * @brief Train the neural network.
  *
  * This method trains the neural network using the provided input and target data.
  * It performs forward and backward passes, updating weights based on the gradients.
+ * The output layer must use the softmax activation, as the network is trained with the
+ * softmax cross-entropy loss.
  *
  * @param input The input data for training.
- * @param target The target output data for training.
+ * @param target The class label of every sample.
  * @param learningRate The learning rate for weight updates.
  * @param epochs The number of training epochs.
+ * @throws std::invalid_argument If the output layer does not use the softmax activation, the target does
+ * not hold one label for every sample, or a label is not finite.
+ * @throws std::out_of_range If a label is not a class of the output layer.
  */
-void FlexNN::NeuralNetwork::train(const Eigen::MatrixXd &input, const Eigen::MatrixXd &target, double learningRate, int epochs)
+template <typename Scalar>
+void FlexNN::BasicNeuralNetwork<Scalar>::train(const Matrix &input, const Matrix &target, Scalar learningRate, int epochs)
 {
-  Eigen::MatrixXd Y_onehot = FlexNN::oneHotEncode(target, target.maxCoeff() + 1); // Convert target to one-hot encoding
-  for (int epoch = 0; epoch < epochs; ++epoch)                                    // for each epoch
+  train(input, target, learningRate, epochs, input.cols(), false); // Full-batch training is a single mini-batch per epoch
+}
+
+/**
+ * @brief Train the neural network using mini-batch gradient descent.
+ *
+ * The input is walked in blocks of `batchSize` columns, and the weights are updated after
+ * every block. The blocks are views into the input matrix, so no sample is copied; when
+ * `shuffle` is set, the order in which the blocks are visited is shuffled every epoch.
+ * The loss and accuracy of every epoch are reported through the epoch callback, see
+ * setEpochCallback() and setValidation().
+ *
+ * @param input The input data for training, in the form (features, samples).
+ * @param target The class label of every sample. The labels are used as class indices by the
+ * loss, so no one-hot matrix of the targets is ever built.
+ * @param learningRate The learning rate for weight updates.
+ * @param epochs The number of training epochs.
+ * @param batchSize The number of samples (columns) in each mini-batch.
+ * @param shuffle Whether to visit the mini-batches in a random order every epoch.
+ * @param numThreads The number of worker threads each mini-batch is split across (requires OpenMP).
+ * @throws std::invalid_argument If the output layer does not use the softmax activation, the target does
+ * not hold one label for every sample, or a label is not finite.
+ * @throws std::out_of_range If a label is not a class of the output layer.
+ */
+template <typename Scalar>
+void FlexNN::BasicNeuralNetwork<Scalar>::train(const Matrix &input, const Matrix &target, Scalar learningRate, int epochs, int batchSize, bool shuffle, int numThreads)
+{
+  if (layers.back().getActivation() != Activation::Softmax)
+    throw std::invalid_argument("The output layer must use the softmax activation to train with the cross-entropy loss");
+  if (target.size() != input.cols())
+    throw std::invalid_argument("The target must hold one label for every sample of the input");
+
+  const int classes = layers.back().getOutputSize();
+  Eigen::VectorXi labels(target.size()); // The class of every sample, the targets are never one-hot encoded
+  for (Eigen::Index i = 0; i < target.size(); ++i)
+  {
+    const double value = static_cast<double>(target(i)); // Checked before the cast, which is undefined for NaN or huge values
+    if (!std::isfinite(value))
+      throw std::invalid_argument("Label " + std::to_string(value) + " is not a class index");
+    if (value < 0 || value >= classes)
+      throw std::out_of_range("Label " + std::to_string(value) + " is not a class of the output layer");
+    labels(i) = static_cast<int>(value);
+  }
+  const int samples = input.cols();
+  batchSize = std::max(1, std::min(batchSize, samples));
+  const int numBatches = (samples + batchSize - 1) / batchSize;
+
+  std::vector<int> order(numBatches); // Order in which the mini-batches are visited
+  std::iota(order.begin(), order.end(), 0);
+  std::mt19937 rng(std::random_device{}());
+
+  numThreads = std::max(1, numThreads);
+  workspaces.resize(numThreads);
+  for (auto &workspace : workspaces)
+    workspace.reserve(layers, (batchSize + numThreads - 1) / numThreads); // Size the buffers once for the batch shape
+
+  std::unique_ptr<AsyncEvaluator<Scalar>> evaluator; // Validates snapshots of the weights while training continues
+  if (validationSource && validationAsync)
+    evaluator.reset(new AsyncEvaluator<Scalar>(layers, *validationSource, validationSamples, validationCallback));
+
+  for (int epoch = 0; epoch < epochs; ++epoch) // for each epoch
   {
-    auto outputs = forward(input);                // Perform forward pass to compute outputs
-    auto gradients = backward(outputs, Y_onehot); // Perform backward pass to compute gradients
-    updateWeights(gradients, learningRate);       // Update weights based on gradients
-    if ((epoch + 1) % 10 == 0)                    // Log the accuracy every 10 epochs for debugging
+    if (shuffle)
+      std::shuffle(order.begin(), order.end(), rng);
+    double epochLoss = 0.0; // Summed over the epoch by the loss stage of every mini-batch
+    long epochCorrect = 0;  // Counted from the same forward passes, no separate evaluation pass
+    for (int batch : order) // for each mini-batch
     {
-      std::cout << "Epoch " << epoch + 1 << "/" << epochs << ": Accuracy = " << this->accuracy(input, target) << std::endl;
+      const int start = batch * batchSize;
+      const int size = std::min(batchSize, samples - start);
+      double batchLoss;
+      long batchCorrect;
+      const BasicWorkspace<Scalar> &gradients = computeGradients(input.middleCols(start, size), labels.segment(start, size), numThreads, batchLoss, batchCorrect); // Forward and backward pass on a view of the batch
+      updateWeights(gradients, learningRate);                                                                                                                      // Update weights based on gradients
+      epochLoss += batchLoss;
+      epochCorrect += batchCorrect;
     }
+    endEpoch(epoch, epochs, epochLoss, epochCorrect, samples, evaluator.get());
   }
+  if (evaluator)
+    evaluator->finish(); // Wait for the last evaluations before returning
+}
+
+/**
+ * @brief Train the neural network using mini-batch gradient descent on a BatchSource.
+ *
+ * Every mini-batch is read from the source into a feature buffer allocated once for the batch
+ * size, and its integer labels into a second preallocated buffer, so the dataset never has to
+ * exist as a whole in floating point form. Batches are read on a background thread
+ * into a pair of such buffers, so the next batch is prepared while the current one is trained
+ * on. When `shuffle` is set, the source visits its samples in a new random order every epoch.
+ * The loss and accuracy of every epoch are reported through the epoch callback, see
+ * setEpochCallback() and setValidation().
+ *
+ * @param source The source of the training samples.
+ * @param learningRate The learning rate for weight updates.
+ * @param epochs The number of training epochs.
+ * @param batchSize The number of samples (columns) in each mini-batch.
+ * @param shuffle Whether to visit the samples in a random order every epoch.
+ * @param numThreads The number of worker threads each mini-batch is split across (requires OpenMP).
+ * @throws std::invalid_argument If the samples of the source or of the validation source do not have
+ * as many features as the network has inputs.
+ * @throws std::out_of_range If a label is not a class of the output layer.
+ */
+template <typename Scalar>
+void FlexNN::BasicNeuralNetwork<Scalar>::train(BatchSource<Scalar> &source, Scalar learningRate, int epochs, int batchSize, bool shuffle, int numThreads)
+{
+  if (layers.back().getActivation() != Activation::Softmax)
+    throw std::invalid_argument("The output layer must use the softmax activation to train with the cross-entropy loss");
+  checkFeatureCount(source);
+  if (validationSource)
+    checkFeatureCount(*validationSource);
+
+  batchSize = std::max(1, batchSize);
+  BatchPrefetcher<Scalar> prefetcher(source, batchSize, layers.back().getOutputSize()); // Reads and checks batch k + 1 while batch k is trained on
+
+  numThreads = std::max(1, numThreads);
+  workspaces.resize(numThreads);
+  for (auto &workspace : workspaces)
+    workspace.reserve(layers, (batchSize + numThreads - 1) / numThreads); // Size the buffers once for the batch shape
+
+  std::unique_ptr<AsyncEvaluator<Scalar>> evaluator; // Validates snapshots of the weights while training continues
+  if (validationSource && validationAsync)
+    evaluator.reset(new AsyncEvaluator<Scalar>(layers, *validationSource, validationSamples, validationCallback));
+
+  for (int epoch = 0; epoch < epochs; ++epoch) // for each epoch
+  {
+    prefetcher.start(shuffle);
+    double epochLoss = 0.0; // Summed over the epoch by the loss stage of every mini-batch
+    long epochCorrect = 0;  // Counted from the same forward passes, no separate evaluation pass
+    long samples = 0;
+    while (const auto *batch = prefetcher.acquire()) // for each mini-batch
+    {
+      double batchLoss;
+      long batchCorrect;
+      const BasicWorkspace<Scalar> &gradients = computeGradients(batch->X.leftCols(batch->size), batch->Y.head(batch->size), numThreads, batchLoss, batchCorrect); // Forward and backward pass on the batch
+      updateWeights(gradients, learningRate);                                                                                                                      // Update weights based on gradients
+      epochLoss += batchLoss;
+      epochCorrect += batchCorrect;
+      samples += batch->size;
+      prefetcher.release();
+    }
+    endEpoch(epoch, epochs, epochLoss, epochCorrect, samples, evaluator.get());
+  }
+  if (evaluator)
+    evaluator->finish(); // Wait for the last evaluations before returning
 }
 
 /**
@@ -50,9 +266,10 @@ void FlexNN::NeuralNetwork::train(const Eigen::MatrixXd &input, const Eigen::Mat
  * @param Y The target output data for comparison.
  * @return The accuracy as a double value.
  */
-double FlexNN::NeuralNetwork::accuracy(const Eigen::MatrixXd &X, const Eigen::MatrixXd &Y)
+template <typename Scalar>
+double FlexNN::BasicNeuralNetwork<Scalar>::accuracy(const Matrix &X, const Matrix &Y) const
 {
-  Eigen::MatrixXd predictions = this->predict(X); // Get predictions from the neural network
+  Matrix predictions = this->predict(X); // Get predictions from the neural network
   int correct = 0;
   for (int i = 0; i < predictions.cols(); ++i) // Iterate through each prediction
   {
@@ -66,6 +283,91 @@ double FlexNN::NeuralNetwork::accuracy(const Eigen::MatrixXd &X, const Eigen::Ma
   return static_cast<double>(correct) / predictions.cols(); // Calculate accuracy as the ratio of correct predictions to total predictions
 }
 
+/**
+ * @brief Calculate the accuracy of the neural network on the samples of a BatchSource.
+ *
+ * The samples are read and evaluated in batches, in the order of the source. The next batch is
+ * read on a background thread while the current one is evaluated.
+ *
+ * @param source The source of the samples to evaluate, which concurrent callers must not share.
+ * @param batchSize The number of samples evaluated at once.
+ * @param maxSamples The number of samples to evaluate from the start of the source, 0 for all of them.
+ * @return The accuracy as a double value.
+ * @throws std::invalid_argument If the samples of the source do not have as many features as the network has inputs.
+ */
+template <typename Scalar>
+double FlexNN::BasicNeuralNetwork<Scalar>::accuracy(BatchSource<Scalar> &source, int batchSize, long maxSamples) const
+{
+  checkFeatureCount(source);
+  batchSize = std::max(1, batchSize);
+  if (maxSamples > 0)
+    batchSize = static_cast<int>(std::min<long>(batchSize, maxSamples));
+  BatchPrefetcher<Scalar> prefetcher(source, batchSize);
+  BasicWorkspace<Scalar> workspace;
+  workspace.reserve(layers, batchSize, false); // Inference needs no gradient buffers
+
+  prefetcher.start(false);
+  long correct = 0, total = 0;
+  while (const auto *batch = prefetcher.acquire())
+  {
+    const int size = maxSamples > 0 ? static_cast<int>(std::min<long>(batch->size, maxSamples - total)) : batch->size;
+    forward(batch->X.leftCols(size), workspace);
+    auto predictions = workspace.activation(layers.size() - 1);
+    for (int i = 0; i < size; ++i)
+    {
+      int predictedClass;
+      predictions.col(i).maxCoeff(&predictedClass);
+      correct += predictedClass == batch->Y(i);
+    }
+    total += size;
+    prefetcher.release();
+    if (maxSamples > 0 && total >= maxSamples)
+      break; // The rest of the pass is never read, the prefetcher stops with it
+  }
+  return total > 0 ? static_cast<double>(correct) / total : 0.0;
+}
+
+/**
+ * @brief Predict the output for a single sample, with low latency.
+ *
+ * Works like the overload below, in a scratch vector owned by the calling thread.
+ *
+ * @param input The input sample.
+ * @return A view of the output of the last layer, valid until the next call of predictOne() on the same thread.
+ */
+template <typename Scalar>
+Eigen::Ref<const typename FlexNN::BasicNeuralNetwork<Scalar>::Vector> FlexNN::BasicNeuralNetwork<Scalar>::predictOne(const Eigen::Ref<const Vector> &input) const
+{
+  thread_local Vector scratch; // Shared by every network of this scalar type on the thread, grown to the widest one
+  return predictOne(input, scratch);
+}
+
+/**
+ * @brief Predict the output for a single sample, with low latency, in a scratch vector provided by the caller.
+ *
+ * Every layer is a matrix-vector product, and the activations ping-pong between the two
+ * halves of the scratch vector, so no intermediate is stored. The scratch is grown to twice
+ * the width of the widest layer if needed, so steady-state calls do not allocate.
+ *
+ * @param input The input sample.
+ * @param scratch The vector to store the activations in.
+ * @return A view of the output of the last layer, valid until the scratch is used again.
+ */
+template <typename Scalar>
+Eigen::Ref<const typename FlexNN::BasicNeuralNetwork<Scalar>::Vector> FlexNN::BasicNeuralNetwork<Scalar>::predictOne(const Eigen::Ref<const Vector> &input, Vector &scratch) const
+{
+  int width = 0; // Every activation fits in a half as wide as the widest layer
+  for (const auto &layer : layers)
+    width = std::max(width, layer.getOutputSize());
+  if (scratch.size() < 2 * width)
+    scratch.resize(2 * width);
+
+  layers[0].forwardOne(input, scratch.segment(0, layers[0].getOutputSize()));
+  for (size_t i = 1; i < layers.size(); ++i) // Each layer reads the output of the previous one and writes the other half
+    layers[i].forwardOne(scratch.segment((i - 1) % 2 * width, layers[i - 1].getOutputSize()), scratch.segment(i % 2 * width, layers[i].getOutputSize()));
+  return scratch.segment((layers.size() - 1) % 2 * width, layers.back().getOutputSize());
+}
+
 /**
  * @brief Forward pass through the neural network.
  *
@@ -73,70 +375,287 @@ double FlexNN::NeuralNetwork::accuracy(const Eigen::MatrixXd &X, const Eigen::Ma
  * computing the activations for each layer based on the input data.
  *
  * @param input The input data for the forward pass.
- * @return A vector of Eigen::MatrixXd containing the outputs of each layer.
+ * @param workspace The workspace to store the activations of each layer in.
  */
-std::vector<Eigen::MatrixXd> FlexNN::NeuralNetwork::forward(const Eigen::MatrixXd &input)
+template <typename Scalar>
+void FlexNN::BasicNeuralNetwork<Scalar>::forward(const Eigen::Ref<const Matrix> &input, BasicWorkspace<Scalar> &workspace) const
 {
-  std::vector<Eigen::MatrixXd> outputs;
-  outputs.push_back(input); // Start with the input as the first output
-  for (size_t i = 0; i < layers.size(); ++i)
+  workspace.setBatchSize(input.cols());
+  layers[0].forward(input, workspace.activation(0)); // The first layer reads the input directly
+  for (size_t i = 1; i < layers.size(); ++i)
   {
-    auto result = layers[i].forward(outputs[outputs.size() - 1]); // Forward pass through the layer
-    outputs.push_back(result.first);
-    outputs.push_back(result.second); // Store both Z and A
+    layers[i].forward(workspace.activation(i - 1), workspace.activation(i)); // Forward pass through the layer
   }
-  return outputs; // Return all outputs including activations and pre-activations
 }
 
 /**
  * @brief Backward pass through the neural network.
  *
  * This method performs a backward pass through the neural network, calculating
- * the gradients for each layer based on the outputs and target data.
+ * the gradients for each layer based on the outputs of the forward pass and the class labels.
  *
- * @param outputs The outputs from the forward pass.
- * @param target The target output data for training.
- * @return A vector of Eigen::MatrixXd containing the gradients for each layer.
+ * @param input The input data of the forward pass.
+ * @param labels The class of every sample.
+ * @param workspace The workspace holding the forward pass outputs, receives the gradients.
+ * @param scale The factor the summed gradients are multiplied by (1 / number of samples in the batch).
+ * @param correct Receives the number of samples the forward pass classified correctly.
+ * @return The softmax cross-entropy loss summed over the samples.
  */
-std::vector<Eigen::MatrixXd> FlexNN::NeuralNetwork::backward(const std::vector<Eigen::MatrixXd> &outputs, const Eigen::MatrixXd &target)
+template <typename Scalar>
+double FlexNN::BasicNeuralNetwork<Scalar>::backward(const Eigen::Ref<const Matrix> &input, const Eigen::Ref<const Eigen::VectorXi> &labels, BasicWorkspace<Scalar> &workspace, Scalar scale, long &correct) const
 {
-  std::vector<Eigen::MatrixXd> gradients;
-  std::vector<Eigen::MatrixXd> dZs; // To store dZ for each layer
+  const int last = layers.size() - 1;
+  const double loss = SoftmaxCrossEntropy::evaluate<Scalar>(workspace.activation(last), labels, workspace.delta(last), correct); // Loss, predictions and initial dZ in one pass
+  for (int i = last; i >= 0; --i)
+  {
+    if (i < last)
+      layers[i].backward(layers[i + 1].getWeights(), workspace.delta(i + 1), workspace.activation(i), workspace.delta(i));
 
-  Eigen::MatrixXd dZ = outputs.back() - target;                          // Compute the initial dZ (gradient of the loss w.r.t. output)
-  dZs.push_back(dZ);                                                     // Store dZ for this layer
-  int m = dZ.cols();                                                     // Number of examples
-  gradients.push_back(dZ.rowwise().mean());                              // Store both dW and db
-  gradients.push_back(dZ * outputs[outputs.size() - 3].transpose() / m); // dW
+    auto dZ = workspace.delta(i);
+    workspace.biasGradient(i).noalias() = scale * dZ.rowwise().sum(); // db
+    if (i > 0)
+      workspace.weightGradient(i).noalias() = scale * dZ * workspace.activation(i - 1).transpose(); // dW
+    else
+      workspace.weightGradient(i).noalias() = scale * dZ * input.transpose(); // dW of the first layer uses the input
+  }
+  return loss;
+}
 
-  for (int i = layers.size() - 2; i >= 0; --i)
+/**
+ * @brief Compute the gradients for a mini-batch, optionally split across worker threads.
+ *
+ * Each worker runs a forward and backward pass on its own slice of the columns in its own
+ * workspace, and the partial gradients are then summed pairwise in a tree, so the result
+ * equals the gradients of the whole mini-batch.
+ *
+ * @param input The input data of the mini-batch.
+ * @param labels The class of every sample of the mini-batch.
+ * @param numThreads The number of worker threads to split the mini-batch across.
+ * @param loss Receives the loss summed over the samples of the mini-batch.
+ * @param correct Receives the number of samples of the mini-batch the forward pass classified correctly.
+ * @return The workspace holding the gradients of the whole mini-batch.
+ */
+template <typename Scalar>
+const FlexNN::BasicWorkspace<Scalar> &FlexNN::BasicNeuralNetwork<Scalar>::computeGradients(const Eigen::Ref<const Matrix> &input, const Eigen::Ref<const Eigen::VectorXi> &labels, int numThreads, double &loss, long &correct)
+{
+  const int size = input.cols();
+  const Scalar scale = Scalar(1) / size;                // Gradients are averaged over the whole mini-batch
+  numThreads = std::max(1, std::min(numThreads, size)); // Every worker needs at least one sample
+  if (workspaces.size() < static_cast<size_t>(numThreads))
+    workspaces.resize(numThreads);
+#ifdef _OPENMP
+  if (numThreads > 1)
   {
-    dZ = layers[i].backward(layers[i + 1].getWeights(), dZs.back(), outputs[2 * i + 1]);
-    dZs.push_back(dZ);                                        // Store dZ for this layer
-    gradients.push_back(dZ.rowwise().mean());                 // Store both db
-    gradients.push_back(dZ * outputs[2 * i].transpose() / m); // dW
-  }
+    double totalLoss = 0.0;
+    long totalCorrect = 0;
+#pragma omp parallel num_threads(numThreads) reduction(+ : totalLoss, totalCorrect)
+    {
+      const int thread = omp_get_thread_num();
+      const int workers = omp_get_num_threads(); // The runtime may grant fewer threads than requested
+      const int start = static_cast<long>(size) * thread / workers;
+      const int sliceSize = static_cast<long>(size) * (thread + 1) / workers - start;
 
-  std::reverse(gradients.begin(), gradients.end()); // Reverse the order of gradients to match layer order
-  // gradients now contains dW and db for each layer in the correct order
-  return gradients;
+      BasicWorkspace<Scalar> &workspace = workspaces[thread];
+      workspace.reserve(layers, sliceSize); // No-op unless the slice outgrew the buffers
+      forward(input.middleCols(start, sliceSize), workspace);
+      long sliceCorrect;
+      totalLoss += backward(input.middleCols(start, sliceSize), labels.segment(start, sliceSize), workspace, scale, sliceCorrect);
+      totalCorrect += sliceCorrect;
+
+      // Tree reduction: at every level, each surviving worker adds in its neighbour `stride` away
+      for (int stride = 1; stride < workers; stride *= 2)
+      {
+#pragma omp barrier
+        if (thread % (2 * stride) == 0 && thread + stride < workers)
+        {
+          for (size_t i = 0; i < layers.size(); ++i)
+          {
+            workspace.weightGradient(i) += workspaces[thread + stride].weightGradient(i);
+            workspace.biasGradient(i) += workspaces[thread + stride].biasGradient(i);
+          }
+        }
+      }
+    }
+    loss = totalLoss;
+    correct = totalCorrect;
+    return workspaces[0];
+  }
+#endif
+  BasicWorkspace<Scalar> &workspace = workspaces[0];
+  workspace.reserve(layers, size);
+  forward(input, workspace);                        // Perform forward pass to compute outputs
+  loss = backward(input, labels, workspace, scale, correct); // Perform backward pass to compute gradients
+  return workspace;
 }
 
 /**
  * @brief Update the weights of the neural network.
  *
  * This method updates the weights of each layer based on the calculated gradients
- * and the specified learning rate.
+ * and the specified learning rate, with the update rule set by setOptimizer().
  *
- * @param gradients A vector of Eigen::MatrixXd containing the gradients for each layer.
+ * @param gradients The workspace holding the gradients for each layer.
  * @param learningRate The learning rate for updating weights.
  */
-void FlexNN::NeuralNetwork::updateWeights(const std::vector<Eigen::MatrixXd> &gradients, double learningRate)
+template <typename Scalar>
+void FlexNN::BasicNeuralNetwork<Scalar>::updateWeights(const BasicWorkspace<Scalar> &gradients, Scalar learningRate)
 {
-  for (int i = 0; i < layers.size(); ++i)
+  for (size_t i = 0; i < layers.size(); ++i)
   {
-    Eigen::MatrixXd dW = gradients[2 * i];
-    Eigen::VectorXd db = gradients[2 * i + 1];
-    layers[i].updateWeights(dW, db, learningRate); // Update weights and biases of the layer
+    layers[i].updateWeights(gradients.weightGradient(i), gradients.biasGradient(i), learningRate, optimizer); // Update weights and biases of the layer
   }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Finish a training epoch: evaluate the validation samples if due and report the metrics.
+ *
+ * @param epoch The index of the epoch, starting at 0.
+ * @param epochs The number of epochs of the training run.
+ * @param loss The loss summed over the samples of the epoch.
+ * @param correct The number of samples of the epoch classified correctly.
+ * @param samples The number of samples of the epoch.
+ * @param evaluator The background evaluator to submit the validation to, or nullptr to validate synchronously.
+ */
+template <typename Scalar>
+void FlexNN::BasicNeuralNetwork<Scalar>::endEpoch(int epoch, int epochs, double loss, long correct, long samples, AsyncEvaluator<Scalar> *evaluator)
+{
+  const bool validate = validationSource && ((epoch + 1) % validationInterval == 0 || epoch + 1 == epochs);
+  if (validate && evaluator)
+    evaluator->submit(epoch + 1, layers); // Reported through the validation callback once evaluated
+
+  EpochStats stats;
+  stats.epoch = epoch + 1;
+  stats.epochs = epochs;
+  stats.samples = samples;
+  stats.loss = samples > 0 ? loss / samples : 0.0;
+  stats.accuracy = samples > 0 ? static_cast<double>(correct) / samples : 0.0;
+  stats.validated = validate && !evaluator;
+  stats.validationAccuracy = stats.validated ? accuracy(*validationSource, 1024, validationSamples) : 0.0;
+  if (stats.validated && validationCallback)
+    validationCallback(stats.epoch, stats.validationAccuracy);
+  if (epochCallback)
+    epochCallback(stats);
+}
+
+/**
+ * @brief Check that the samples of a source fit the input layer, before any batch is read from it.
+ *
+ * @param source The source to check.
+ * @throws std::invalid_argument If the samples do not have as many features as the network has inputs.
+ */
+template <typename Scalar>
+void FlexNN::BasicNeuralNetwork<Scalar>::checkFeatureCount(const BatchSource<Scalar> &source) const
+{
+  if (source.getFeatureCount() != layers.front().getInputSize())
+    throw std::invalid_argument("The samples have " + std::to_string(source.getFeatureCount()) + " features, but the input layer takes " +
+                                std::to_string(layers.front().getInputSize()));
+}
+
+/**
+ * @brief Save the architecture, weights and biases of the network to a model file.
+ *
+ * @param filename The path to the model file to create (or replace).
+ * @throws std::runtime_error If the file cannot be written.
+ */
+template <typename Scalar>
+void FlexNN::BasicNeuralNetwork<Scalar>::save(const std::string &filename) const
+{
+  ModelHeader header = {};
+  std::memcpy(header.magic, modelMagic, sizeof(modelMagic));
+  header.version = modelVersion;
+  header.scalarType = static_cast<uint32_t>(std::is_same<Scalar, float>::value ? DataType::Float32 : DataType::Float64);
+  header.layers = static_cast<uint32_t>(layers.size());
+  header.layerOffset = sizeof(header);
+
+  std::vector<ModelLayer> table(layers.size());
+  uint64_t offset = alignUp(header.layerOffset + sizeof(ModelLayer) * table.size(), modelAlignment);
+  for (size_t i = 0; i < layers.size(); ++i) // Lay the weights and biases out one layer after the other
+  {
+    table[i].inputSize = static_cast<uint32_t>(layers[i].getInputSize());
+    table[i].outputSize = static_cast<uint32_t>(layers[i].getOutputSize());
+    table[i].activation = static_cast<uint32_t>(layers[i].getActivation());
+    table[i].reserved = 0;
+    table[i].weightOffset = offset;
+    table[i].biasOffset = alignUp(offset + sizeof(Scalar) * layers[i].getWeights().size(), modelAlignment);
+    offset = alignUp(table[i].biasOffset + sizeof(Scalar) * layers[i].getBiases().size(), modelAlignment);
+  }
+
+  const std::string temporary = filename + ".tmp";
+  std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("Could not create " + temporary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(table.data()), static_cast<std::streamsize>(sizeof(ModelLayer) * table.size()));
+  for (size_t i = 0; i < layers.size(); ++i)
+  {
+    padTo(out, table[i].weightOffset);
+    out.write(reinterpret_cast<const char *>(layers[i].getWeights().data()), static_cast<std::streamsize>(sizeof(Scalar) * layers[i].getWeights().size()));
+    padTo(out, table[i].biasOffset);
+    out.write(reinterpret_cast<const char *>(layers[i].getBiases().data()), static_cast<std::streamsize>(sizeof(Scalar) * layers[i].getBiases().size()));
+  }
+  commitFile(out, temporary, filename); // Replaces the file atomically, mappings of the old one stay valid
+}
+
+/**
+ * @brief Load a network from a model file written by save().
+ *
+ * @param filename The path to the model file.
+ * @return The network stored in the file.
+ * @throws std::runtime_error If the file cannot be mapped or is not a valid model file.
+ */
+template <typename Scalar>
+FlexNN::BasicNeuralNetwork<Scalar> FlexNN::BasicNeuralNetwork<Scalar>::load(const std::string &filename)
+{
+  std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(filename);
+  ModelHeader header;
+  if (file->size() < sizeof(header))
+    throw std::runtime_error(filename + " is not a model file");
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (std::memcmp(header.magic, modelMagic, sizeof(modelMagic)) != 0)
+    throw std::runtime_error(filename + " is not a model file");
+  if (header.version != modelVersion)
+    throw std::runtime_error(filename + " has unsupported model version " + std::to_string(header.version));
+  const DataType stored = static_cast<DataType>(header.scalarType);
+  if (stored != DataType::Float32 && stored != DataType::Float64)
+    throw std::runtime_error(filename + " has an unknown element type");
+  const uint64_t elementSize = stored == DataType::Float32 ? sizeof(float) : sizeof(double);
+  if (header.layers == 0 || !fitsIn(header.layerOffset, header.layers, sizeof(ModelLayer), file->size()))
+    throw std::runtime_error(filename + " is truncated or corrupt");
+
+  std::vector<BasicLayer<Scalar>> layers;
+  layers.reserve(header.layers);
+  for (uint32_t i = 0; i < header.layers; ++i)
+  {
+    ModelLayer entry;
+    std::memcpy(&entry, file->data() + header.layerOffset + i * sizeof(ModelLayer), sizeof(entry));
+    const bool valid = entry.inputSize > 0 && entry.outputSize > 0 && entry.inputSize <= INT32_MAX && entry.outputSize <= INT32_MAX &&
+                       entry.activation <= static_cast<uint32_t>(Activation::Softmax) &&
+                       (i == 0 || static_cast<int>(entry.inputSize) == layers.back().getOutputSize()) &&
+                       entry.weightOffset % elementSize == 0 && entry.biasOffset % elementSize == 0 && // The arrays are used in place
+                       fitsIn(entry.weightOffset, static_cast<uint64_t>(entry.inputSize) * entry.outputSize, elementSize, file->size()) &&
+                       fitsIn(entry.biasOffset, entry.outputSize, elementSize, file->size());
+    if (!valid)
+      throw std::runtime_error(filename + " is truncated or corrupt");
+
+    const char *weights = file->data() + entry.weightOffset;
+    const char *biases = file->data() + entry.biasOffset;
+    if (elementSize == sizeof(Scalar)) // Point into the mapping, nothing is copied
+    {
+      layers.push_back(BasicLayer<Scalar>(entry.inputSize, entry.outputSize, static_cast<Activation>(entry.activation), file,
+                                          reinterpret_cast<const Scalar *>(weights), reinterpret_cast<const Scalar *>(biases)));
+    }
+    else
+    {
+      BasicLayer<Scalar> layer(entry.inputSize, entry.outputSize, static_cast<Activation>(entry.activation), nullptr, nullptr, nullptr);
+      layer.W = stored == DataType::Float32 ? convertModel<float, Scalar>(weights, entry.outputSize, entry.inputSize)
+                                            : convertModel<double, Scalar>(weights, entry.outputSize, entry.inputSize);
+      layer.b = stored == DataType::Float32 ? convertModel<float, Scalar>(biases, entry.outputSize, 1)
+                                            : convertModel<double, Scalar>(biases, entry.outputSize, 1);
+      layers.push_back(layer);
+    }
+  }
+  return BasicNeuralNetwork(layers);
+}
+
+template class FlexNN::BasicNeuralNetwork<float>;
+template class FlexNN::BasicNeuralNetwork<double>;
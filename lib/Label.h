@@ -0,0 +1,40 @@
+/**
+ * @file Label.h
+ * @brief Internal conversion of stored class labels in the FlexNN neural network library.
+ *
+ * This file holds the check shared by the batch sources that read labels stored as floating point
+ * values (matrices, CSV cells and dataset files) before they become integer classes. It is not part
+ * of the public headers.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_Label_H
+#define FlexNN_Label_H
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace FlexNN
+{
+  /**
+   * @brief Convert a stored label to an integer class.
+   *
+   * Converting a NaN, an infinity or a value outside the range of int is undefined, so such values
+   * are rejected before the cast. Whether the class exists is checked later, against the output
+   * layer.
+   *
+   * @param value The stored label.
+   * @return The label, truncated to an integer.
+   * @throws std::invalid_argument If the label is not a finite value in the range of int.
+   */
+  inline int toLabel(double value)
+  {
+    if (!(std::isfinite(value) && value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max()))
+      throw std::invalid_argument("Label " + std::to_string(value) + " is not a class index");
+    return static_cast<int>(value);
+  }
+}
+
+#endif // FlexNN_Label_H
@@ -8,75 +8,441 @@
  *
  * @author Nalin Angrish <nalin@nalinangrish.me>
  */
-#include <utility>
+#include <cmath>
+#include <string>
 #include <Eigen/Dense>
 
 #include "Layer.h"
+#include "Parallel.h"
+
+namespace
+{
+  /**
+   * @brief Kernels of an activation function, specialized at compile time.
+   *
+   * forward() adds the bias to the linear output held in A and applies the activation in the
+   * same pass, in place. backward() multiplies the gradient with respect to A (held in dZ) by the
+   * derivative of the activation, recovered from A, in place.
+   */
+  template <typename Scalar, FlexNN::Activation>
+  struct ActivationTraits;
+
+  template <typename Scalar>
+  struct ActivationTraits<Scalar, FlexNN::Activation::Linear>
+  {
+    typedef Eigen::MatrixX<Scalar> Matrix;
+
+    static void forward(const Eigen::Ref<const Eigen::VectorX<Scalar>> &b, Eigen::Ref<Matrix> A)
+    {
+      A.colwise() += b; // No activation function, just the linear output
+    }
+
+    static void backward(const Eigen::Ref<const Matrix> &, Eigen::Ref<Matrix>)
+    {
+      // No activation function, just pass the gradient
+    }
+  };
+
+  template <typename Scalar>
+  struct ActivationTraits<Scalar, FlexNN::Activation::ReLU>
+  {
+    typedef Eigen::MatrixX<Scalar> Matrix;
+
+    static void forward(const Eigen::Ref<const Eigen::VectorX<Scalar>> &b, Eigen::Ref<Matrix> A)
+    {
+      A = (A.colwise() + b).cwiseMax(Scalar(0)); // Bias and ReLU in one vectorized pass
+    }
+
+    static void backward(const Eigen::Ref<const Matrix> &A, Eigen::Ref<Matrix> dZ)
+    {
+      // Derivative of ReLU: 1 if Z > 0 (equivalently A > 0), else 0
+      dZ.array() *= (A.array() > Scalar(0)).template cast<Scalar>();
+    }
+  };
+
+  template <typename Scalar>
+  struct ActivationTraits<Scalar, FlexNN::Activation::Softmax>
+  {
+    typedef Eigen::MatrixX<Scalar> Matrix;
+
+    static void forward(const Eigen::Ref<const Eigen::VectorX<Scalar>> &b, Eigen::Ref<Matrix> A)
+    {
+      // Numerically stable softmax, applied column-wise in place. Each column is small enough to
+      // stay in L1 across its passes, the exp is Eigen's vectorized polynomial approximation, and
+      // wide batches are split across threads (this runs serially inside a data-parallel worker).
+      const long cols = A.cols();
+#pragma omp parallel for schedule(static) if (cols >= FlexNN::minParallelColumns)
+      for (long i = 0; i < cols; ++i)
+      {
+        auto col = A.col(i);
+        col += b;
+        const Scalar maxCoeff = col.maxCoeff();
+        col = (col.array() - maxCoeff).exp().matrix();
+        col *= Scalar(1) / col.sum();
+      }
+    }
+
+    static void backward(const Eigen::Ref<const Matrix> &A, Eigen::Ref<Matrix> dZ)
+    {
+      // Gradient for Softmax, the Jacobian-vector product A * (dA - dot(A, dA)) of each column
+      for (long i = 0; i < A.cols(); ++i)
+      {
+        const Scalar dot = A.col(i).dot(dZ.col(i));
+        dZ.col(i).array() = A.col(i).array() * (dZ.col(i).array() - dot);
+      }
+    }
+  };
+
+  /**
+   * @brief Forward pass of a layer with a given activation function.
+   */
+  template <typename Scalar, FlexNN::Activation activation>
+  void forwardImpl(const Eigen::Ref<const Eigen::MatrixX<Scalar>> &W, const Eigen::Ref<const Eigen::VectorX<Scalar>> &b,
+                   const Eigen::Ref<const Eigen::MatrixX<Scalar>> &input, Eigen::Ref<Eigen::MatrixX<Scalar>> A)
+  {
+    A.noalias() = W * input; // Linear transformation
+    ActivationTraits<Scalar, activation>::forward(b, A);
+  }
+
+  /**
+   * @brief Forward pass of a single sample through a layer with a given activation function.
+   */
+  template <typename Scalar, FlexNN::Activation activation>
+  void forwardOneImpl(const Eigen::Ref<const Eigen::MatrixX<Scalar>> &W, const Eigen::Ref<const Eigen::VectorX<Scalar>> &b,
+                      const Eigen::Ref<const Eigen::VectorX<Scalar>> &input, Eigen::Ref<Eigen::VectorX<Scalar>> a)
+  {
+    a.noalias() = W * input; // Matrix-vector product
+    ActivationTraits<Scalar, activation>::forward(b, a);
+  }
+
+  /**
+   * @brief Backward pass of a layer with a given activation function.
+   */
+  template <typename Scalar, FlexNN::Activation activation>
+  void backwardImpl(const Eigen::Ref<const Eigen::MatrixX<Scalar>> &nextW, const Eigen::Ref<const Eigen::MatrixX<Scalar>> &nextdZ,
+                    const Eigen::Ref<const Eigen::MatrixX<Scalar>> &currA, Eigen::Ref<Eigen::MatrixX<Scalar>> dZ)
+  {
+    dZ.noalias() = nextW.transpose() * nextdZ; // Gradient with respect to this layer's activation
+    ActivationTraits<Scalar, activation>::backward(currA, dZ);
+  }
+
+  /**
+   * @brief Coefficients of one update step, computed once per layer and step.
+   */
+  template <typename Scalar>
+  struct UpdateCoefficients
+  {
+    Scalar rate;    // Learning rate, with the bias correction of Adam folded in
+    Scalar beta1;   // Momentum coefficient or decay of the first moment
+    Scalar beta2;   // Decay of the mean squared gradient
+    Scalar epsilon; // Added to the denominator, with the bias correction of Adam folded in
+  };
+
+  /**
+   * @brief Kernels of an update rule, specialized at compile time.
+   *
+   * update() applies one step to a contiguous run of n parameters (w) and their optimizer state
+   * (m, v; null when the rule does not use them) from the matching gradients (g). Every element
+   * is read and written once, in a loop the compiler vectorizes, so no temporary is created.
+   */
+  template <typename Scalar, FlexNN::OptimizerType>
+  struct OptimizerTraits;
+
+  template <typename Scalar>
+  struct OptimizerTraits<Scalar, FlexNN::OptimizerType::SGD>
+  {
+    static void update(long n, Scalar *w, Scalar *, Scalar *, const Scalar *g, const UpdateCoefficients<Scalar> &c)
+    {
+      for (long i = 0; i < n; ++i)
+        w[i] -= c.rate * g[i];
+    }
+  };
+
+  template <typename Scalar>
+  struct OptimizerTraits<Scalar, FlexNN::OptimizerType::Momentum>
+  {
+    static void update(long n, Scalar *w, Scalar *m, Scalar *, const Scalar *g, const UpdateCoefficients<Scalar> &c)
+    {
+      for (long i = 0; i < n; ++i)
+      {
+        m[i] = c.beta1 * m[i] + g[i]; // Velocity
+        w[i] -= c.rate * m[i];
+      }
+    }
+  };
+
+  template <typename Scalar>
+  struct OptimizerTraits<Scalar, FlexNN::OptimizerType::Nesterov>
+  {
+    static void update(long n, Scalar *w, Scalar *m, Scalar *, const Scalar *g, const UpdateCoefficients<Scalar> &c)
+    {
+      for (long i = 0; i < n; ++i)
+      {
+        m[i] = c.beta1 * m[i] + g[i];             // Velocity
+        w[i] -= c.rate * (g[i] + c.beta1 * m[i]); // Step from the look-ahead point
+      }
+    }
+  };
+
+  template <typename Scalar>
+  struct OptimizerTraits<Scalar, FlexNN::OptimizerType::RMSProp>
+  {
+    static void update(long n, Scalar *w, Scalar *, Scalar *v, const Scalar *g, const UpdateCoefficients<Scalar> &c)
+    {
+      for (long i = 0; i < n; ++i)
+      {
+        v[i] = c.beta2 * v[i] + (Scalar(1) - c.beta2) * g[i] * g[i]; // Mean squared gradient
+        w[i] -= c.rate * g[i] / (std::sqrt(v[i]) + c.epsilon);
+      }
+    }
+  };
+
+  template <typename Scalar>
+  struct OptimizerTraits<Scalar, FlexNN::OptimizerType::Adam>
+  {
+    static void update(long n, Scalar *w, Scalar *m, Scalar *v, const Scalar *g, const UpdateCoefficients<Scalar> &c)
+    {
+      for (long i = 0; i < n; ++i)
+      {
+        m[i] = c.beta1 * m[i] + (Scalar(1) - c.beta1) * g[i];        // First moment
+        v[i] = c.beta2 * v[i] + (Scalar(1) - c.beta2) * g[i] * g[i]; // Second moment
+        w[i] -= c.rate * m[i] / (std::sqrt(v[i]) + c.epsilon);
+      }
+    }
+  };
+
+  /**
+   * @brief Apply an update rule to a parameter tensor and its optimizer state, column by column.
+   *
+   * The parameters and state are contiguous; the gradient may be a view with an outer stride.
+   */
+  template <typename Scalar, FlexNN::OptimizerType type, typename Tensor>
+  void updateTensor(Tensor &P, Tensor &M, Tensor &V, const Scalar *g, Eigen::Index gradientStride, const UpdateCoefficients<Scalar> &c)
+  {
+    const long rows = P.rows();
+    for (Eigen::Index j = 0; j < P.cols(); ++j)
+    {
+      const long offset = j * rows;
+      OptimizerTraits<Scalar, type>::update(rows, P.data() + offset, M.size() ? M.data() + offset : nullptr,
+                                            V.size() ? V.data() + offset : nullptr, g + j * gradientStride, c);
+    }
+  }
+
+  /**
+   * @brief Apply an update rule to the weights and biases of a layer.
+   */
+  template <typename Scalar, FlexNN::OptimizerType type>
+  void updateImpl(Eigen::MatrixX<Scalar> &W, Eigen::VectorX<Scalar> &b, Eigen::MatrixX<Scalar> &mW, Eigen::MatrixX<Scalar> &vW,
+                  Eigen::VectorX<Scalar> &mb, Eigen::VectorX<Scalar> &vb, const Eigen::Ref<const Eigen::MatrixX<Scalar>> &dW,
+                  const Eigen::Ref<const Eigen::VectorX<Scalar>> &db, const UpdateCoefficients<Scalar> &c)
+  {
+    updateTensor<Scalar, type>(W, mW, vW, dW.data(), dW.outerStride(), c);
+    updateTensor<Scalar, type>(b, mb, vb, db.data(), 0, c);
+  }
+}
+
+/**
+ * @brief Parse the name of an activation function.
+ *
+ * @param name The name of the activation function ("relu", "softmax" or "linear").
+ * @return The matching Activation, or Activation::Linear for any other name.
+ */
+FlexNN::Activation FlexNN::parseActivation(const std::string &name)
+{
+  if (name == "relu")
+    return Activation::ReLU;
+  if (name == "softmax")
+    return Activation::Softmax;
+  return Activation::Linear; // Any other name means no activation function
+}
 
 /**
  * @brief Forward pass through the layer.
  *
  * This method computes the output of the layer given an input matrix.
- * It applies the activation function to the linear combination of inputs and weights.
+ * The linear combination of inputs and weights is written straight into the output buffer,
+ * and the bias and activation function are then applied to it in a single in-place pass,
+ * so the linear output (Z) is never stored.
  *
  * @param input The input data for the forward pass.
- * @return A pair containing the linear output (Z) and the activated output (A).
+ * @param A The buffer to store the activated output (A) in, which must already have the right shape.
  */
-std::pair<Eigen::MatrixXd, Eigen::MatrixXd> FlexNN::Layer::forward(const Eigen::MatrixXd &input)
+template <typename Scalar>
+void FlexNN::BasicLayer<Scalar>::forward(const Eigen::Ref<const Matrix> &input, Eigen::Ref<Matrix> A) const
 {
-  Eigen::MatrixXd output = (W * input).colwise() + b; // Linear transformation
-  Eigen::MatrixXd activation;
-  if (activationFunction == "relu")
+  switch (activation)
   {
-    activation = output.unaryExpr([](double x)
-                                  { return std::max(0.0, x); }); // ReLU activation
-  }
-  else if (activationFunction == "softmax")
-  {
-    // Numerically stable softmax, applied column-wise
-    activation = output;
-    for (int i = 0; i < output.cols(); ++i)
-    {
-      Eigen::VectorXd col = output.col(i);
-      double maxCoeff = col.maxCoeff();
-      Eigen::VectorXd expCol = (col.array() - maxCoeff).exp();
-      activation.col(i) = expCol / expCol.sum();
-    }
+  case Activation::ReLU:
+    forwardImpl<Scalar, Activation::ReLU>(weights(), biases(), input, A);
+    break;
+  case Activation::Softmax:
+    forwardImpl<Scalar, Activation::Softmax>(weights(), biases(), input, A);
+    break;
+  default:
+    forwardImpl<Scalar, Activation::Linear>(weights(), biases(), input, A);
+    break;
   }
-  else
+}
+
+/**
+ * @brief Forward pass of a single sample through the layer.
+ *
+ * This works like forward(), but on vectors: the linear combination is a matrix-vector
+ * product written straight into the output, and the bias and activation function are applied
+ * to it in place.
+ *
+ * @param input The input sample.
+ * @param a The buffer to store the activated output in, with one entry per neuron.
+ */
+template <typename Scalar>
+void FlexNN::BasicLayer<Scalar>::forwardOne(const Eigen::Ref<const Vector> &input, Eigen::Ref<Vector> a) const
+{
+  switch (activation)
   {
-    activation = output; // No activation function, just return the linear output
+  case Activation::ReLU:
+    forwardOneImpl<Scalar, Activation::ReLU>(weights(), biases(), input, a);
+    break;
+  case Activation::Softmax:
+    forwardOneImpl<Scalar, Activation::Softmax>(weights(), biases(), input, a);
+    break;
+  default:
+    forwardOneImpl<Scalar, Activation::Linear>(weights(), biases(), input, a);
+    break;
   }
-  return std::make_pair(output, activation); // Z, A
 }
 
 /**
  * @brief Backward pass through the layer.
  *
  * This method computes the gradient of the loss with respect to the inputs of this layer
- * given the gradients from the next layer.
+ * given the gradients from the next layer. The derivative of the activation function is
+ * recovered from the activated output (for ReLU, A > 0 exactly where Z > 0).
  *
  * @param nextW The weights of the next layer.
  * @param nextdZ The gradients from the next layer.
- * @param currZ The linear output (Z) of this layer.
- * @return The gradient of the loss with respect to the inputs of this layer (dZ).
+ * @param currA The activated output (A) of this layer.
+ * @param dZ The buffer to store the gradient of the loss with respect to the inputs of this layer in.
  */
-Eigen::MatrixXd FlexNN::Layer::backward(const Eigen::MatrixXd &nextW, const Eigen::MatrixXd &nextdZ, const Eigen::MatrixXd &currZ)
+template <typename Scalar>
+void FlexNN::BasicLayer<Scalar>::backward(const Eigen::Ref<const Matrix> &nextW, const Eigen::Ref<const Matrix> &nextdZ,
+                                          const Eigen::Ref<const Matrix> &currA, Eigen::Ref<Matrix> dZ) const
 {
-  Eigen::MatrixXd dZ;
-  if (activationFunction == "relu")
+  switch (activation)
   {
-    // Derivative of ReLU: 1 if currZ > 0, else 0
-    dZ = (nextW.transpose() * nextdZ).array() * (currZ.array() > 0.0).cast<double>();
+  case Activation::ReLU:
+    backwardImpl<Scalar, Activation::ReLU>(nextW, nextdZ, currA, dZ);
+    break;
+  case Activation::Softmax:
+    backwardImpl<Scalar, Activation::Softmax>(nextW, nextdZ, currA, dZ);
+    break;
+  default:
+    backwardImpl<Scalar, Activation::Linear>(nextW, nextdZ, currA, dZ);
+    break;
   }
-  else if (activationFunction == "softmax")
+}
+
+/**
+ * @brief Copy the weights and biases of another layer of the same shape.
+ *
+ * Only the parameters are copied, into the buffers this layer already has, or the mapping
+ * is shared if the other layer still reads them from a model file. The optimizer state of
+ * this layer is left as it is.
+ *
+ * @param other The layer to copy the parameters of.
+ */
+template <typename Scalar>
+void FlexNN::BasicLayer<Scalar>::copyParameters(const BasicLayer &other)
+{
+  if (other.mapping) // Still read-only, point into the same mapping
+  {
+    mapping = other.mapping;
+    mappedW = other.mappedW;
+    mappedb = other.mappedb;
+    return;
+  }
+  mapping.reset();
+  W = other.W; // Same shape, so the existing buffers are reused
+  b = other.b;
+}
+
+/**
+ * @brief Update weights and biases.
+ *
+ * This method updates the weights and biases of the layer using the provided gradients
+ * and a specified learning rate. The gradients are read where they are (typically in the
+ * training workspace) and each parameter is updated, together with the optimizer state
+ * kept next to it, in a single in-place pass with no temporaries. Mapped weights and biases
+ * are first copied into the layer.
+ *
+ * @param dW The gradient of the weights.
+ * @param db The gradient of the biases.
+ * @param learningRate The learning rate for updating the weights and biases.
+ * @param optimizer The update rule to apply.
+ */
+template <typename Scalar>
+void FlexNN::BasicLayer<Scalar>::updateWeights(const Eigen::Ref<const Matrix> &dW, const Eigen::Ref<const Vector> &db, Scalar learningRate,
+                                               const Optimizer &optimizer)
+{
+  if (mapping) // Copy on write: the mapped parameters are copied into the layer before they change
+  {
+    W = weights();
+    b = biases();
+    mapping.reset();
+  }
+  if (optimizer.type != stateType) // A new update rule starts from a fresh state
+  {
+    stateType = optimizer.type;
+    step = 0;
+    mW.resize(0, 0);
+    vW.resize(0, 0);
+    mb.resize(0);
+    vb.resize(0);
+  }
+  const bool firstMoment = stateType == OptimizerType::Momentum || stateType == OptimizerType::Nesterov || stateType == OptimizerType::Adam;
+  const bool secondMoment = stateType == OptimizerType::RMSProp || stateType == OptimizerType::Adam;
+  if (firstMoment && mW.size() == 0) // Allocated once, next to the parameters they belong to
+  {
+    mW = Matrix::Zero(W.rows(), W.cols());
+    mb = Vector::Zero(b.size());
+  }
+  if (secondMoment && vW.size() == 0)
   {
-    Eigen::VectorXd expZ = currZ.array().exp();
-    dZ = (nextW.transpose() * nextdZ) * (expZ / expZ.sum()).matrix(); // Gradient for Softmax
+    vW = Matrix::Zero(W.rows(), W.cols());
+    vb = Vector::Zero(b.size());
   }
-  else
+  ++step;
+
+  UpdateCoefficients<Scalar> c;
+  c.rate = learningRate;
+  c.beta1 = static_cast<Scalar>(optimizer.beta1);
+  c.beta2 = static_cast<Scalar>(optimizer.beta2);
+  c.epsilon = static_cast<Scalar>(optimizer.epsilon);
+  if (stateType == OptimizerType::Adam) // Fold the bias correction of both moments into the step size and epsilon
   {
-    dZ = nextW.transpose() * nextdZ; // No activation function, just pass the gradient
+    const double correction2 = std::sqrt(1.0 - std::pow(optimizer.beta2, static_cast<double>(step)));
+    c.rate = static_cast<Scalar>(learningRate * correction2 / (1.0 - std::pow(optimizer.beta1, static_cast<double>(step))));
+    c.epsilon = static_cast<Scalar>(optimizer.epsilon * correction2);
   }
-  return dZ; // Return the gradient of Z
-}
\ No newline at end of file
+
+  switch (stateType)
+  {
+  case OptimizerType::Momentum:
+    updateImpl<Scalar, OptimizerType::Momentum>(W, b, mW, vW, mb, vb, dW, db, c);
+    break;
+  case OptimizerType::Nesterov:
+    updateImpl<Scalar, OptimizerType::Nesterov>(W, b, mW, vW, mb, vb, dW, db, c);
+    break;
+  case OptimizerType::RMSProp:
+    updateImpl<Scalar, OptimizerType::RMSProp>(W, b, mW, vW, mb, vb, dW, db, c);
+    break;
+  case OptimizerType::Adam:
+    updateImpl<Scalar, OptimizerType::Adam>(W, b, mW, vW, mb, vb, dW, db, c);
+    break;
+  default:
+    updateImpl<Scalar, OptimizerType::SGD>(W, b, mW, vW, mb, vb, dW, db, c);
+    break;
+  }
+}
+
+template class FlexNN::BasicLayer<float>;
+template class FlexNN::BasicLayer<double>;
@@ -0,0 +1,50 @@
+/**
+ * @file Loss.cpp
+ * @brief Source file for the loss functions of the FlexNN neural network library.
+ *
+ * This file defines the output stage of the network, which turns the activations of the last
+ * layer and the targets into the value of the loss and the gradient the backward pass starts from.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#include <cmath>
+#include <algorithm>
+#include <Eigen/Dense>
+
+#include "Loss.h"
+#include "Parallel.h"
+
+/**
+ * @brief Compute the loss and the output gradient of a batch from integer class labels.
+ *
+ * @param A The softmax activations of the last layer, in the form (classes, samples).
+ * @param labels The class of every sample, each in [0, classes).
+ * @param dZ The buffer to store the gradient with respect to the last pre-activation in.
+ * @param correct Receives the number of samples whose largest activation is at their label.
+ * @return The cross-entropy loss summed over the samples of the batch.
+ */
+template <typename Scalar>
+double FlexNN::SoftmaxCrossEntropy::evaluate(const Eigen::Ref<const Eigen::MatrixX<Scalar>> &A, const Eigen::Ref<const Eigen::VectorXi> &labels,
+                                             Eigen::Ref<Eigen::MatrixX<Scalar>> dZ, long &correct)
+{
+  const double minProbability = 1e-12; // Keeps log() finite when a class gets no probability at all
+  const long cols = A.cols();
+  double loss = 0.0;
+  long hits = 0;
+#pragma omp parallel for schedule(static) reduction(+ : loss, hits) if (cols >= minParallelColumns)
+  for (long j = 0; j < cols; ++j)
+  {
+    const int label = labels(j);
+    int predicted;
+    A.col(j).maxCoeff(&predicted);
+    hits += predicted == label;
+    dZ.col(j) = A.col(j);      // Gradient of softmax + cross-entropy w.r.t. the pre-activation is A - Y,
+    dZ(label, j) -= Scalar(1); // and the one-hot Y only differs from zero at the label
+    loss -= std::log(std::max<double>(A(label, j), minProbability)); // Only the target class contributes to the loss
+  }
+  correct = hits;
+  return loss;
+}
+
+template double FlexNN::SoftmaxCrossEntropy::evaluate<float>(const Eigen::Ref<const Eigen::MatrixXf> &, const Eigen::Ref<const Eigen::VectorXi> &, Eigen::Ref<Eigen::MatrixXf>, long &);
+template double FlexNN::SoftmaxCrossEntropy::evaluate<double>(const Eigen::Ref<const Eigen::MatrixXd> &, const Eigen::Ref<const Eigen::VectorXi> &, Eigen::Ref<Eigen::MatrixXd>, long &);
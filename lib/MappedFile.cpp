@@ -0,0 +1,58 @@
+/**
+ * @file MappedFile.cpp
+ * @brief Source file for the MappedFile class in the FlexNN neural network library.
+ *
+ * This file defines the MappedFile class, a read-only memory mapping of a whole file.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#include <string>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MappedFile.h"
+
+/**
+ * @brief Map a file into memory.
+ *
+ * @param filename The path to the file to map.
+ * @throws std::runtime_error If the file cannot be opened or mapped.
+ */
+FlexNN::MappedFile::MappedFile(const std::string &filename) : bytes(nullptr), length(0)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Could not open " + filename);
+
+  struct stat info;
+  if (::fstat(fd, &info) != 0)
+  {
+    ::close(fd);
+    throw std::runtime_error("Could not stat " + filename);
+  }
+  length = static_cast<size_t>(info.st_size);
+  if (length > 0) // mmap() rejects empty mappings, an empty file simply has no data
+  {
+    void *mapping = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+      ::close(fd);
+      throw std::runtime_error("Could not map " + filename);
+    }
+    ::madvise(mapping, length, MADV_WILLNEED); // Start reading ahead, the loaders touch the whole file
+    bytes = static_cast<const char *>(mapping);
+  }
+  ::close(fd); // The mapping keeps its own reference to the file
+}
+
+/**
+ * @brief Unmap the file.
+ */
+FlexNN::MappedFile::~MappedFile()
+{
+  if (bytes)
+    ::munmap(const_cast<char *>(bytes), length);
+}
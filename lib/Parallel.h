@@ -0,0 +1,21 @@
+/**
+ * @file Parallel.h
+ * @brief Internal threading thresholds of the FlexNN neural network library.
+ *
+ * This file holds the tuning constants shared by the kernels that split their work across OpenMP
+ * threads, so every kernel makes the same decision. It is not part of the public headers.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_Parallel_H
+#define FlexNN_Parallel_H
+
+namespace FlexNN
+{
+  /**
+   * @brief Minimum number of columns before a column-wise kernel is split across threads.
+   */
+  const long minParallelColumns = 256;
+}
+
+#endif // FlexNN_Parallel_H
@@ -12,12 +12,147 @@
 #include <Eigen/Dense>
 #include <string>
 #include <vector>
-#include <fstream>
-#include <sstream>
+#include <limits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <numeric>
 #include <random>
 #include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "Utility.h"
+#include "BatchSource.h"
+#include "CSVParser.h"
+#include "Dataset.h"
+#include "MappedFile.h"
+
+namespace
+{
+  using FlexNN::csv::isBlankLine;
+  using FlexNN::csv::lineEnd;
+  using FlexNN::csv::nextLine;
+  using FlexNN::csv::parseRow;
+
+  /**
+   * @brief Split a range of lines into newline-aligned chunks, a few per thread.
+   *
+   * @return The chunk boundaries; chunk k spans [bounds[k], bounds[k + 1]).
+   */
+  std::vector<const char *> splitLines(const char *begin, const char *end)
+  {
+#ifdef _OPENMP
+    const long numChunks = 4 * omp_get_max_threads(); // A few chunks per thread to even out the load
+#else
+    const long numChunks = 1;
+#endif
+    std::vector<const char *> bounds(numChunks + 1, begin);
+    bounds[numChunks] = end;
+    for (long k = 1; k < numChunks; ++k)
+    {
+      const char *guess = begin + (end - begin) * k / numChunks;
+      const char *boundary = guess == begin ? begin : nextLine(guess - 1, end); // Move to the next line start
+      bounds[k] = std::max(boundary, bounds[k - 1]);
+    }
+    return bounds;
+  }
+
+  /**
+   * @brief Count the non-blank lines of a chunk.
+   */
+  long countRows(const char *begin, const char *end)
+  {
+    long rows = 0;
+    for (const char *line = begin; line < end; line = nextLine(line, end))
+      rows += !isBlankLine(line, lineEnd(line, end));
+    return rows;
+  }
+
+  /**
+   * @brief Shuffle the indices of the samples of a dataset and compute the size of each split.
+   *
+   * @param nRows The number of samples.
+   * @param proportions The proportion of the samples in each split.
+   * @param sizes Receives the number of samples in each split; the last split takes the rounding remainder.
+   * @return The shuffled indices, split k taking the next sizes[k] of them.
+   */
+  std::vector<long> shuffledSplit(long nRows, const std::vector<double> &proportions, std::vector<size_t> &sizes)
+  {
+    std::vector<long> indices(nRows);
+    std::iota(indices.begin(), indices.end(), 0L); // Fill indices with 0, 1, ..., nRows-1
+
+    // Shuffle indices
+    std::random_device rd;
+    std::mt19937 g(rd());
+    std::shuffle(indices.begin(), indices.end(), g);
+
+    // Calculate split sizes
+    sizes.clear();
+    size_t total = 0;
+    for (size_t i = 0; i < proportions.size(); ++i)
+    {
+      size_t sz = static_cast<size_t>(proportions[i] * nRows); // Calculate size for this split
+      sizes.push_back(sz);
+      total += sz;
+    }
+    // Adjust last split to cover all rows (in case of rounding)
+    if (!sizes.empty())
+      sizes.back() += nRows - total;
+    return indices;
+  }
+
+  /**
+   * @brief Element type code of unsigned bytes in the magic number of an IDX file.
+   */
+  const unsigned char idxUnsignedByte = 0x08;
+
+  /**
+   * @brief An array stored in an IDX file.
+   */
+  struct IDXArray
+  {
+    const char *data;        // Start of the elements in the mapping
+    std::vector<long> dims;  // Size of every dimension, the number of samples first
+  };
+
+  /**
+   * @brief Parse the header of a memory-mapped IDX file of unsigned bytes.
+   *
+   * The header is the magic number (two zero bytes, the element type and the number of
+   * dimensions) followed by the size of every dimension as a big-endian 32-bit integer.
+   *
+   * @throws std::runtime_error If the file is not an IDX file of unsigned bytes or is truncated.
+   */
+  IDXArray parseIDX(const FlexNN::MappedFile &file, const std::string &filename)
+  {
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(file.data());
+    if (file.size() < 4 || bytes[0] != 0 || bytes[1] != 0)
+      throw std::runtime_error(filename + " is not an IDX file");
+    if (bytes[2] != idxUnsignedByte)
+      throw std::runtime_error(filename + " does not hold unsigned bytes");
+
+    IDXArray array;
+    const size_t headerSize = 4 + 4 * static_cast<size_t>(bytes[3]);
+    if (bytes[3] == 0 || file.size() < headerSize)
+      throw std::runtime_error(filename + " is not an IDX file");
+    const uint64_t available = file.size() - headerSize; // Bytes after the header, one per element
+    uint64_t elements = 1;
+    for (size_t offset = 4; offset < headerSize; offset += 4)
+    {
+      const uint32_t dim = (uint32_t(bytes[offset]) << 24) | (uint32_t(bytes[offset + 1]) << 16) | (uint32_t(bytes[offset + 2]) << 8) | uint32_t(bytes[offset + 3]);
+      array.dims.push_back(static_cast<long>(dim));
+      if (dim != 0 && elements > available / dim) // Compare by division so corrupt sizes cannot overflow the product
+        throw std::runtime_error(filename + " is truncated");
+      elements *= dim;
+    }
+    array.data = file.data() + headerSize; // Unsigned bytes have no byte order, the elements are used as they are
+    return array;
+  }
+}
 
 /**
  * @brief One-hot encodes a vector of class labels.
@@ -27,16 +162,17 @@
  *
  * @param Y The input vector of class labels.
  * @param num_classes The number of unique classes.
- * @return An Eigen::MatrixXd where each row is a one-hot encoded vector for the corresponding class label.
+ * @return An Eigen matrix where each row is a one-hot encoded vector for the corresponding class label.
  */
-Eigen::MatrixXd FlexNN::oneHotEncode(const Eigen::VectorXd &Y, int num_classes)
+template <typename Scalar>
+Eigen::MatrixX<Scalar> FlexNN::oneHotEncode(const Eigen::VectorX<Scalar> &Y, int num_classes)
 {
-  Eigen::MatrixXd Y_onehot = Eigen::MatrixXd::Zero(num_classes, Y.size()); // Initialize a zero matrix with num_classes rows and Y.size() columns
+  Eigen::MatrixX<Scalar> Y_onehot = Eigen::MatrixX<Scalar>::Zero(num_classes, Y.size()); // Initialize a zero matrix with num_classes rows and Y.size() columns
   for (int i = 0; i < Y.size(); ++i)
   {
     int label = static_cast<int>(Y(i));
     if (label >= 0 && label < num_classes)
-      Y_onehot(label, i) = 1.0; // Set the corresponding position to 1
+      Y_onehot(label, i) = Scalar(1); // Set the corresponding position to 1
   }
   return Y_onehot;
 }
@@ -49,49 +185,133 @@ Eigen::MatrixXd FlexNN::oneHotEncode(const Eigen::VectorXd &Y, int num_classes)
  * Eigen matrices with the data from the CSV file.
  *
  * @param filename The path to the CSV file to read.
- * @param X The Eigen::MatrixXd to store the features (all columns except the first).
- * @param Y The Eigen::VectorXd to store the labels (the first column).
+ * @param X The Eigen matrix to store the features (all columns except the first).
+ * @param Y The Eigen vector to store the labels (the first column).
+ * @throws std::runtime_error If the file cannot be read or a row is malformed.
  */
-void FlexNN::readCSV_XY(const std::string &filename, Eigen::MatrixXd &X, Eigen::VectorXd &Y)
+template <typename Scalar>
+void FlexNN::readCSV_XY(const std::string &filename, Eigen::MatrixX<Scalar> &X, Eigen::VectorX<Scalar> &Y)
 {
-  std::ifstream file(filename);
-  std::vector<std::vector<double>> data;
-  std::string line;
-  size_t cols = 0;
+  readCSV_XY(filename, X, Y, DataLayout::SamplesByFeatures, Scalar(1));
+}
 
-  // skip the header line
-  if (std::getline(file, line))
-  {
-    // We don't really need to do anything with the header line, yet
-    // Though we could parse it if needed to get column names
-  }
-  while (std::getline(file, line))
+/**
+ * @brief Reads a CSV file into features (X) and labels (Y) with a given layout and scaling.
+ *
+ * The file is memory-mapped and split into newline-aligned chunks that are parsed in parallel.
+ * A first pass counts the rows of every chunk so the matrices can be sized up front, and the
+ * second pass parses each cell, scales it and stores it straight into its final place in the
+ * requested layout, so every value is touched exactly once.
+ *
+ * @param filename The path to the CSV file to read.
+ * @param X The Eigen matrix to store the features (all columns except the first).
+ * @param Y The Eigen vector to store the labels (the first column).
+ * @param layout The layout to store the features in.
+ * @param scale The factor every feature is multiplied by.
+ * @throws std::runtime_error If the file cannot be read or a row is malformed.
+ */
+template <typename Scalar>
+void FlexNN::readCSV_XY(const std::string &filename, Eigen::MatrixX<Scalar> &X, Eigen::VectorX<Scalar> &Y, DataLayout layout, Scalar scale)
+{
+  MappedFile file(filename);
+  const char *end = file.data() + file.size();
+  const char *begin = nextLine(file.data(), end); // skip the header line
+
+  // The first non-blank line tells the number of columns
+  const char *first = begin;
+  while (first < end && isBlankLine(first, lineEnd(first, end)))
+    first = nextLine(first, end);
+  const long cols = 1 + std::count(first, lineEnd(first, end), ',');
+
+  // Split the body into newline-aligned chunks, count their rows, and turn the counts into offsets
+  std::vector<const char *> bounds = splitLines(begin, end);
+  const long numChunks = bounds.size() - 1;
+  std::vector<long> firstRow(numChunks + 1, 0);
+#pragma omp parallel for schedule(dynamic)
+  for (long k = 0; k < numChunks; ++k)
+    firstRow[k + 1] = countRows(bounds[k], bounds[k + 1]);
+  std::partial_sum(firstRow.begin(), firstRow.end(), firstRow.begin());
+
+  const long nRows = firstRow.back();
+  const long nFeatures = cols - 1; // Features are all columns except the first
+  if (layout == DataLayout::FeaturesBySamples)
+    X.resize(nFeatures, nRows);
+  else
+    X.resize(nRows, nFeatures);
+  Y.resize(nRows); // Labels are the first column
+
+  // Distance between consecutive samples and consecutive features of a sample in X's storage
+  const long sampleStride = layout == DataLayout::FeaturesBySamples ? nFeatures : 1;
+  const long featureStride = layout == DataLayout::FeaturesBySamples ? 1 : nRows;
+
+  std::vector<long> badRow(numChunks, -1);
+#pragma omp parallel for schedule(dynamic)
+  for (long k = 0; k < numChunks; ++k)
   {
-    std::stringstream ss(line);
-    std::string cell;
-    std::vector<double> row;
-    while (std::getline(ss, cell, ',')) // Split by comma
+    long row = firstRow[k];
+    for (const char *line = bounds[k]; line < bounds[k + 1] && badRow[k] < 0; line = nextLine(line, bounds[k + 1]))
     {
-      row.push_back(std::stod(cell)); // Convert string to double
+      const char *stop = lineEnd(line, bounds[k + 1]);
+      if (isBlankLine(line, stop))
+        continue;
+      Scalar *sample = X.data() + row * sampleStride;
+      bool ok = parseRow(line, stop, cols, [&](long j, double value)
+                         {
+                           if (j == 0)
+                             Y(row) = static_cast<Scalar>(value); // Fill labels with the first column
+                           else
+                             sample[(j - 1) * featureStride] = static_cast<Scalar>(value) * scale; // Cell j is feature j - 1, scaled
+                         });
+      if (!ok)
+        badRow[k] = row;
+      ++row;
     }
-    if (cols == 0)
-      cols = row.size();
-    data.push_back(row); // Add the row to the data vector
   }
+  for (long k = 0; k < numChunks; ++k)
+  {
+    if (badRow[k] >= 0)
+      throw std::runtime_error("Malformed row " + std::to_string(badRow[k] + 1) + " in " + filename);
+  }
+}
 
-  size_t nRows = data.size();
-  size_t nCols = cols;
-  X.resize(nRows, nCols - 1); // Features are all columns except the first
-  Y.resize(nRows);            // Labels are the first column
+/**
+ * @brief Opens a pair of IDX files (the binary format MNIST is distributed in) as a Dataset.
+ *
+ * Both files are memory-mapped and only their big-endian headers are read. The returned Dataset
+ * points straight into the mappings, so no pixel is parsed or copied.
+ *
+ * @param imagesFilename The path to the IDX file of the images (e.g. train-images-idx3-ubyte).
+ * @param labelsFilename The path to the IDX file of the labels (e.g. train-labels-idx1-ubyte).
+ * @param scale The feature scale of the dataset, 1/255 to normalize pixels.
+ * @return A dataset of uint8_t features and labels.
+ * @throws std::runtime_error If a file cannot be mapped, is not an IDX file of unsigned bytes,
+ * is truncated, or the files do not hold the same number of samples.
+ */
+FlexNN::Dataset FlexNN::readIDX(const std::string &imagesFilename, const std::string &labelsFilename, double scale)
+{
+  auto imageFile = std::make_shared<MappedFile>(imagesFilename);
+  auto labelFile = std::make_shared<MappedFile>(labelsFilename);
+  const IDXArray images = parseIDX(*imageFile, imagesFilename);
+  const IDXArray labels = parseIDX(*labelFile, labelsFilename);
+  if (images.dims.size() < 2)
+    throw std::runtime_error(imagesFilename + " does not hold images");
+  if (labels.dims.size() != 1)
+    throw std::runtime_error(labelsFilename + " does not hold labels");
+  if (images.dims[0] != labels.dims[0])
+    throw std::runtime_error(imagesFilename + " and " + labelsFilename + " do not hold the same number of samples");
+
+  if (images.dims[0] == 0)
+    throw std::runtime_error(imagesFilename + " holds no images");
 
-  for (size_t i = 0; i < nRows; ++i)
+  long features = 1; // Every image is stored row by row, so it is a column of a (features, samples) matrix
+  for (size_t i = 1; i < images.dims.size(); ++i)
   {
-    Y(i) = data[i][0]; // Fill labels with the first column
-    for (size_t j = 1; j < nCols; ++j)
-    {
-      X(i, j - 1) = data[i][j]; // Fill features, skipping the first column
-    }
+    if (images.dims[i] == 0 || features > std::numeric_limits<long>::max() / images.dims[i])
+      throw std::runtime_error(imagesFilename + " has an invalid image size");
+    features *= images.dims[i];
   }
+  return Dataset(imageFile, images.data, DataType::UInt8, features,
+                 labelFile, labels.data, DataType::UInt8, images.dims[0], scale);
 }
 
 /**
@@ -100,50 +320,87 @@ void FlexNN::readCSV_XY(const std::string &filename, Eigen::MatrixXd &X, Eigen::
  * This function takes a dataset represented by features (X) and labels (Y),
  * and splits it into multiple sets according to the provided proportions.
  *
- * @param X The input feature matrix (Eigen::MatrixXd).
- * @param Y The input label vector (Eigen::VectorXd).
+ * @param X The input feature matrix.
+ * @param Y The input label vector.
  * @param proportions A vector of doubles representing the proportions for each split.
+ * @param layout The layout of X (and of the returned feature matrices).
  * @return A vector of pairs, where each pair contains a feature matrix and a label vector for each split.
  */
-std::vector<std::pair<Eigen::MatrixXd, Eigen::VectorXd>>
-FlexNN::splitXY(const Eigen::MatrixXd &X, const Eigen::VectorXd &Y, const std::vector<double> &proportions)
+template <typename Scalar>
+std::vector<std::pair<Eigen::MatrixX<Scalar>, Eigen::VectorX<Scalar>>>
+FlexNN::splitXY(const Eigen::MatrixX<Scalar> &X, const Eigen::VectorX<Scalar> &Y, const std::vector<double> &proportions,
+                DataLayout layout)
 {
-  size_t nRows = X.rows();
-  std::vector<size_t> indices(nRows);
-  std::iota(indices.begin(), indices.end(), 0); // Fill indices with 0, 1, ..., nRows-1
-
-  // Shuffle indices
-  std::random_device rd;
-  std::mt19937 g(rd());
-  std::shuffle(indices.begin(), indices.end(), g);
-
-  // Calculate split sizes
+  const bool samplesAreColumns = layout == DataLayout::FeaturesBySamples;
+  const long nRows = samplesAreColumns ? X.cols() : X.rows(); // Number of samples
   std::vector<size_t> sizes;
-  size_t total = 0;
-  for (size_t i = 0; i < proportions.size(); ++i)
-  {
-    size_t sz = static_cast<size_t>(proportions[i] * nRows); // Calculate size for this split
-    sizes.push_back(sz);
-    total += sz;
-  }
-  // Adjust last split to cover all rows (in case of rounding)
-  if (!sizes.empty())
-    sizes.back() += nRows - total;
+  std::vector<long> indices = shuffledSplit(nRows, proportions, sizes);
 
-  std::vector<std::pair<Eigen::MatrixXd, Eigen::VectorXd>> splits;
+  std::vector<std::pair<Eigen::MatrixX<Scalar>, Eigen::VectorX<Scalar>>> splits;
   size_t start = 0;
   for (size_t k = 0; k < sizes.size(); ++k) // Iterate over each split size
   {
     size_t sz = sizes[k];
-    Eigen::MatrixXd X_split(sz, X.cols()); // Create a new matrix for the split
-    Eigen::VectorXd Y_split(sz);
-    for (size_t i = 0; i < sz; ++i) // Fill the split matrices
+    Eigen::MatrixX<Scalar> X_split; // Create a new matrix for the split
+    Eigen::VectorX<Scalar> Y_split(sz);
+    if (samplesAreColumns)
     {
-      X_split.row(i) = X.row(indices[start + i]);
-      Y_split(i) = Y(indices[start + i]);
+      X_split.resize(X.rows(), sz);
+      for (size_t i = 0; i < sz; ++i) // Samples are contiguous columns, copy them whole
+        X_split.col(i) = X.col(indices[start + i]);
     }
+    else
+    {
+      X_split.resize(sz, X.cols());
+      for (size_t i = 0; i < sz; ++i)
+        X_split.row(i) = X.row(indices[start + i]);
+    }
+    for (size_t i = 0; i < sz; ++i) // Fill the split labels
+      Y_split(i) = Y(indices[start + i]);
     splits.emplace_back(std::move(X_split), std::move(Y_split)); // Add the split to the result vector
     start += sz;
   }
   return splits;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Splits the dataset into multiple views based on specified proportions, without copying it.
+ *
+ * Each split is a MatrixBatchSource holding a shuffled list of sample indices into X and Y,
+ * so the splits share the memory of the dataset.
+ *
+ * @param X The input feature matrix, which must outlive the views.
+ * @param Y The input label vector, which must outlive the views.
+ * @param proportions A vector of doubles representing the proportions for each split.
+ * @param layout The layout of X.
+ * @return A vector of views, one for each split.
+ */
+template <typename Scalar>
+std::vector<FlexNN::MatrixBatchSource<Scalar>>
+FlexNN::splitXYView(const Eigen::MatrixX<Scalar> &X, const Eigen::VectorX<Scalar> &Y, const std::vector<double> &proportions,
+                    DataLayout layout)
+{
+  const long nRows = layout == DataLayout::FeaturesBySamples ? X.cols() : X.rows(); // Number of samples
+  std::vector<size_t> sizes;
+  std::vector<long> indices = shuffledSplit(nRows, proportions, sizes);
+
+  std::vector<MatrixBatchSource<Scalar>> views;
+  auto start = indices.begin();
+  for (size_t sz : sizes) // Each view only owns the indices of its samples
+  {
+    views.emplace_back(X, Y, std::vector<long>(start, start + sz), layout);
+    start += sz;
+  }
+  return views;
+}
+
+template Eigen::MatrixXf FlexNN::oneHotEncode<float>(const Eigen::VectorXf &, int);
+template Eigen::MatrixXd FlexNN::oneHotEncode<double>(const Eigen::VectorXd &, int);
+template void FlexNN::readCSV_XY<float>(const std::string &, Eigen::MatrixXf &, Eigen::VectorXf &);
+template void FlexNN::readCSV_XY<double>(const std::string &, Eigen::MatrixXd &, Eigen::VectorXd &);
+template void FlexNN::readCSV_XY<float>(const std::string &, Eigen::MatrixXf &, Eigen::VectorXf &, DataLayout, float);
+template void FlexNN::readCSV_XY<double>(const std::string &, Eigen::MatrixXd &, Eigen::VectorXd &, DataLayout, double);
+template std::vector<std::pair<Eigen::MatrixXf, Eigen::VectorXf>> FlexNN::splitXY<float>(const Eigen::MatrixXf &, const Eigen::VectorXf &, const std::vector<double> &, DataLayout);
+template std::vector<std::pair<Eigen::MatrixXd, Eigen::VectorXd>> FlexNN::splitXY<double>(const Eigen::MatrixXd &, const Eigen::VectorXd &, const std::vector<double> &, DataLayout);
+template std::vector<FlexNN::MatrixBatchSource<float>> FlexNN::splitXYView<float>(const Eigen::MatrixXf &, const Eigen::VectorXf &, const std::vector<double> &, DataLayout);
+template std::vector<FlexNN::MatrixBatchSource<double>> FlexNN::splitXYView<double>(const Eigen::MatrixXd &, const Eigen::VectorXd &, const std::vector<double> &, DataLayout);
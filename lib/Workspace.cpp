@@ -0,0 +1,58 @@
+/**
+ * @file Workspace.cpp
+ * @brief Source file for the Workspace class in the FlexNN neural network library.
+ *
+ * This file defines the Workspace class, which owns every buffer a forward and backward pass
+ * writes to: the activations of each layer, the gradients of the loss with respect to the
+ * pre-activations, and the weight and bias gradients.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#include <vector>
+#include <algorithm>
+#include <Eigen/Dense>
+
+#include "Workspace.h"
+
+/**
+ * @brief Allocate the buffers for a network and a maximum batch size.
+ *
+ * Does nothing if the workspace already fits the given layers and batch size, so it is cheap
+ * to call before every batch.
+ *
+ * @param layers The layers of the network the workspace is used with.
+ * @param maxBatchSize The maximum number of columns (samples) in a batch.
+ * @param withGradients Whether to allocate the buffers needed by the backward pass.
+ */
+template <typename Scalar>
+void FlexNN::BasicWorkspace<Scalar>::reserve(const std::vector<BasicLayer<Scalar>> &layers, int maxBatchSize, bool withGradients)
+{
+  bool fits = maxBatchSize <= capacity && (this->withGradients || !withGradients) && As.size() == layers.size();
+  for (size_t i = 0; fits && i < layers.size(); ++i)
+  {
+    fits = As[i].rows() == layers[i].getOutputSize() && (!this->withGradients || dWs[i].cols() == layers[i].getInputSize());
+  }
+  if (fits)
+    return; // Already large enough, keep the existing buffers
+
+  capacity = std::max(maxBatchSize, capacity);
+  this->withGradients = this->withGradients || withGradients;
+  As.resize(layers.size());
+  dZs.resize(this->withGradients ? layers.size() : 0);
+  dWs.resize(dZs.size());
+  dbs.resize(dZs.size());
+  for (size_t i = 0; i < layers.size(); ++i)
+  {
+    const int rows = layers[i].getOutputSize();
+    As[i].resize(rows, capacity);
+    if (this->withGradients)
+    {
+      dZs[i].resize(rows, capacity);
+      dWs[i].resize(rows, layers[i].getInputSize());
+      dbs[i].resize(rows);
+    }
+  }
+}
+
+template class FlexNN::BasicWorkspace<float>;
+template class FlexNN::BasicWorkspace<double>;
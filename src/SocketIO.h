@@ -0,0 +1,69 @@
+/**
+ * @file SocketIO.h
+ * @brief Socket helpers shared by the inference server and its load generator.
+ *
+ * This file holds the blocking read and write loops both ends of the server protocol (see
+ * server.cpp) use to move whole messages over a stream socket.
+ *
+ * @author Nalin Angrish <nalin@nalinangrish.me>
+ */
+#ifndef FlexNN_SocketIO_H
+#define FlexNN_SocketIO_H
+
+#include <cerrno>
+#include <cstddef>
+#include <unistd.h>
+
+namespace FlexNN
+{
+  /**
+   * @namespace FlexNN::socketio
+   * @brief Whole-message I/O on blocking stream sockets.
+   */
+  namespace socketio
+  {
+    /**
+     * @brief Read exactly `size` bytes from a socket.
+     *
+     * @return false if the peer closed the connection or an error occurred first.
+     */
+    inline bool readFully(int fd, void *data, size_t size)
+    {
+      char *bytes = static_cast<char *>(data);
+      while (size > 0)
+      {
+        const ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          return false;
+        bytes += n;
+        size -= n;
+      }
+      return true;
+    }
+
+    /**
+     * @brief Write exactly `size` bytes to a socket.
+     *
+     * @return false if the peer closed the connection or an error occurred first.
+     */
+    inline bool writeFully(int fd, const void *data, size_t size)
+    {
+      const char *bytes = static_cast<const char *>(data);
+      while (size > 0)
+      {
+        const ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          return false;
+        bytes += n;
+        size -= n;
+      }
+      return true;
+    }
+  }
+}
+
+#endif // FlexNN_SocketIO_H
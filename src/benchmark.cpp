@@ -0,0 +1,111 @@
+/**
+ * @file benchmark.cpp
+ * @brief Throughput benchmark for FlexNN on the MNIST digit recognition example.
+ *
+ * This file runs the same pipeline as main.cpp (read the CSV in the network's layout, split) and then
+ * trains the same network once in double precision and once in single precision, reporting the
+ * training throughput and the accuracy reached for both, so the two scalar types can be compared.
+ * For each trained network it then measures the single-sample latency of predict() and predictOne().
+ *
+ * Usage: benchmark [epochs] [batch size] [threads]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "FlexNN.h"
+#include "Utility.h"
+
+/**
+ * @brief Time a single-sample prediction on every test sample and print the mean and 99th percentile latency.
+ *
+ * @param name The name of the prediction path, for the report.
+ * @param X_test The test features, in the form (features, samples).
+ * @param predict The function predicting one column of X_test.
+ */
+template <typename Scalar, typename Predict>
+void runLatency(const char *name, const Eigen::MatrixX<Scalar> &X_test, Predict predict)
+{
+  std::vector<double> latencies(X_test.cols());
+  volatile Scalar sink = 0; // Keeps the predictions from being optimized away
+  for (long i = 0; i < X_test.cols(); ++i)
+  {
+    auto start = std::chrono::steady_clock::now();
+    sink = sink + predict(i);
+    latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  double mean = 0.0;
+  for (double latency : latencies)
+    mean += latency;
+  mean /= latencies.size();
+  std::nth_element(latencies.begin(), latencies.begin() + latencies.size() * 99 / 100, latencies.end());
+  std::cout << "  " << name << ": mean " << mean << " us, p99 " << latencies[latencies.size() * 99 / 100] << " us" << std::endl;
+}
+
+/**
+ * @brief Train and evaluate a network with the given scalar type and print its throughput.
+ *
+ * @param name The name of the scalar type, for the report.
+ * @param X The training features, in the form (features, samples).
+ * @param Y The training labels.
+ * @param X_test The test features, in the form (features, samples).
+ * @param Y_test The test labels.
+ * @param epochs The number of training epochs.
+ * @param batchSize The number of samples in each mini-batch.
+ * @param threads The number of worker threads each mini-batch is split across.
+ */
+template <typename Scalar>
+void runBenchmark(const char *name, const Eigen::MatrixX<Scalar> &X, const Eigen::MatrixX<Scalar> &Y,
+                  const Eigen::MatrixX<Scalar> &X_test, const Eigen::MatrixX<Scalar> &Y_test, int epochs, int batchSize, int threads)
+{
+  std::srand(42); // Same initial weights for both scalar types
+  FlexNN::BasicNeuralNetwork<Scalar> nn({FlexNN::BasicLayer<Scalar>(X.rows(), 64, "relu"),
+                                         FlexNN::BasicLayer<Scalar>(64, 10, "softmax")});
+
+  auto start = std::chrono::steady_clock::now();
+  nn.train(X, Y, Scalar(0.1), epochs, batchSize, true, threads);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << name << ": " << seconds << " s, "
+            << static_cast<double>(X.cols()) * epochs / seconds << " samples/s, "
+            << "test accuracy " << nn.accuracy(X_test, Y_test) * 100 << "%" << std::endl;
+
+  runLatency<Scalar>("predict   ", X_test, [&](long i)
+                     { return nn.predict(X_test.col(i))(0, 0); });
+  runLatency<Scalar>("predictOne", X_test, [&](long i)
+                     { return nn.predictOne(X_test.col(i))(0); });
+}
+
+/**
+ * @brief Main function of the benchmark.
+ *
+ * Loads the MNIST dataset once in double precision, converts a copy to single precision and
+ * trains the same architecture on both.
+ */
+int main(int argc, char **argv)
+{
+  const int epochs = argc > 1 ? std::atoi(argv[1]) : 5;
+  const int batchSize = argc > 2 ? std::atoi(argv[2]) : 256;
+  const int threads = argc > 3 ? std::atoi(argv[3]) : 1;
+
+  Eigen::MatrixXd X;
+  Eigen::VectorXd Y;
+  std::cout << "Reading CSV file..." << std::endl;
+  FlexNN::readCSV_XY("data/mnist-digit-recognition.csv", X, Y, FlexNN::DataLayout::FeaturesBySamples, 1.0 / 255.0);
+
+  std::vector<std::pair<Eigen::MatrixXd, Eigen::VectorXd>> data =
+      FlexNN::splitXY(X, Y, {0.9, 0.1}, FlexNN::DataLayout::FeaturesBySamples);
+  const Eigen::MatrixXd &X_train = data[0].first; // (features, samples)
+  const Eigen::MatrixXd &X_test = data[1].first;
+  Eigen::MatrixXd Y_train = data[0].second;
+  Eigen::MatrixXd Y_test = data[1].second;
+
+  std::cout << "Training " << epochs << " epochs with batch size " << batchSize << " on " << threads << " thread(s)." << std::endl;
+  runBenchmark<double>("double", X_train, Y_train, X_test, Y_test, epochs, batchSize, threads);
+  runBenchmark<float>("float ", X_train.cast<float>(), Y_train.cast<float>(), X_test.cast<float>(), Y_test.cast<float>(), epochs, batchSize, threads);
+  return 0;
+}
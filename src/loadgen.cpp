@@ -0,0 +1,154 @@
+/**
+ * @file loadgen.cpp
+ * @brief Load generator for the FlexNN inference server.
+ *
+ * This file opens a number of concurrent connections to the inference server (see server.cpp), each of
+ * which sends requests one after the other as fast as the answers come back (a closed loop), and reports
+ * the throughput of the server together with the mean, median and 99th percentile latency of a request.
+ * Running it with an increasing number of connections shows how batching trades latency for throughput.
+ *
+ * The requests carry random features in [0, 1]; only the timing is of interest here.
+ *
+ * Usage: loadgen [socket path] [connections] [requests per connection]
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "SocketIO.h"
+
+namespace
+{
+  using FlexNN::socketio::readFully;
+  using FlexNN::socketio::writeFully;
+
+  /**
+   * @brief Connect to the server.
+   *
+   * Errors are reported on stderr, and no socket is left open when the connection fails.
+   *
+   * @return The connected socket, or -1 if the connection cannot be established.
+   */
+  int connectTo(const std::string &socketPath)
+  {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+      std::cerr << "The socket path " << socketPath << " is too long." << std::endl;
+      return -1;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+      std::cerr << "Could not create socket " << socketPath << ": " << std::strerror(errno) << std::endl;
+      return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+      std::cerr << "Could not connect to " << socketPath << ": " << std::strerror(errno) << std::endl;
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  /**
+   * @brief Send requests on one connection and record the latency of each, in microseconds.
+   *
+   * @param fd The connected socket.
+   * @param requests The number of requests to send.
+   * @param seed The seed of the random features.
+   * @param latencies Receives the latency of every answered request.
+   */
+  void generate(int fd, int requests, unsigned seed, std::vector<double> &latencies)
+  {
+    uint32_t header[2];
+    if (!readFully(fd, header, sizeof(header)))
+      return;
+    std::vector<float> input(header[0]), output(header[1]);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> pixel(0.0f, 1.0f);
+
+    latencies.reserve(requests);
+    for (int r = 0; r < requests; ++r)
+    {
+      for (float &x : input)
+        x = pixel(rng);
+      auto start = std::chrono::steady_clock::now();
+      if (!writeFully(fd, input.data(), input.size() * sizeof(float)) ||
+          !readFully(fd, output.data(), output.size() * sizeof(float)))
+        break;
+      latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+  }
+}
+
+/**
+ * @brief Main function of the load generator.
+ *
+ * Connects all the clients first, so the measurement only covers the requests, then runs them
+ * concurrently on one thread each and reports the combined results.
+ */
+int main(int argc, char **argv)
+{
+  const std::string socketPath = argc > 1 ? argv[1] : "/tmp/flexnn.sock";
+  const int connections = argc > 2 ? std::max(1, std::atoi(argv[2])) : 16;
+  const int requests = argc > 3 ? std::max(1, std::atoi(argv[3])) : 10000;
+
+  std::vector<int> sockets;
+  for (int c = 0; c < connections; ++c)
+  {
+    const int fd = connectTo(socketPath);
+    if (fd < 0)
+    {
+      for (int connected : sockets)
+        close(connected);
+      return 1;
+    }
+    sockets.push_back(fd);
+  }
+
+  std::vector<std::vector<double>> latencies(connections); // One list per client, merged at the end
+  std::vector<std::thread> clients;
+  auto start = std::chrono::steady_clock::now();
+  for (int c = 0; c < connections; ++c)
+    clients.emplace_back(generate, sockets[c], requests, static_cast<unsigned>(c), std::ref(latencies[c]));
+  for (auto &client : clients)
+    client.join();
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  for (int fd : sockets)
+    close(fd);
+
+  std::vector<double> all;
+  for (const auto &list : latencies)
+    all.insert(all.end(), list.begin(), list.end());
+  if (all.empty())
+  {
+    std::cout << "No request was answered." << std::endl;
+    return 1;
+  }
+  double mean = 0.0;
+  for (double latency : all)
+    mean += latency;
+  mean /= all.size();
+  std::sort(all.begin(), all.end());
+
+  std::cout << connections << " connection(s), " << all.size() << " requests in " << seconds << " s: "
+            << all.size() / seconds << " requests/s, latency mean " << mean << " us, p50 " << all[all.size() / 2]
+            << " us, p99 " << all[all.size() * 99 / 100] << " us" << std::endl;
+  return 0;
+}
@@ -3,65 +3,112 @@
  * @brief Main file for the MNIST digit recognition example using FlexNN.
  *
  * This file demonstrates how to use the FlexNN library to create, train, and evaluate a neural network
- * for recognizing handwritten digits from the MNIST dataset. It includes reading the dataset from a CSV file,
- * normalizing the data, splitting it into training and test sets, defining the neural network architecture,
- * training the network, and evaluating its performance. The user can also test the model with specific indices
- * from the test set to see the predicted and actual labels, along with an ASCII representation of the image.
+ * for recognizing handwritten digits from the MNIST dataset. It includes reading the dataset from a CSV file
+ * (cached in the binary dataset format after the first run), normalizing the data, splitting it into training
+ * and test sets, defining the neural network architecture, training the network (or loading the model saved by
+ * an earlier run), and evaluating its performance.
+ * The user can also test the model with specific indices from the test set to see the predicted and actual labels,
+ * along with an ASCII representation of the image.
  */
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
 #include <vector>
 #include <Eigen/Dense>
 
+#include "Dataset.h"
 #include "FlexNN.h"
-#include "Utility.h"
 
 /**
  * @brief Main function to demonstrate a simple neural network for MNIST digit recognition.
  *
  * This program reads the MNIST dataset from a CSV file, normalizes the data, splits it into training and test sets,
- * creates a neural network with two layers, trains the network on the training data, and evaluates its accuracy on both training and test sets.
+ * creates a neural network with two layers, trains the network on the training data (or loads the one saved by an earlier run),
+ * and evaluates its accuracy on both training and test sets.
  * It also allows the user to input an index to test the model's prediction on a specific sample from the test set.
  * The predicted label and actual label are displayed, along with an ASCII representation of the image.
  */
 int main()
 {
-  Eigen::MatrixXd X;
-  Eigen::VectorXd Y;
-  // Read the MNIST dataset from a CSV file
-  std::cout << "Reading CSV file..." << std::endl;
-  FlexNN::readCSV_XY("data/mnist-digit-recognition.csv", X, Y);
-  X = X.array() / 255.0; // Normalize the input data
+  // Convert the MNIST dataset from CSV to the binary dataset format on the first run, later runs map the cached file
+  // The pixels are kept as bytes with a scale of 1/255, so they are only normalized (and converted to double) when a
+  // mini-batch is assembled, and each sample is stored as a column to match the (features, samples) input of FlexNN
+  const std::string csvFile = "data/mnist-digit-recognition.csv";
+  const std::string datasetFile = "data/mnist-digit-recognition.bin";
+  if (!std::ifstream(datasetFile))
+  {
+    std::cout << "Reading CSV file..." << std::endl;
+    FlexNN::Dataset::fromCSV(csvFile, datasetFile, FlexNN::DataType::UInt8, 1.0 / 255.0);
+  }
+  FlexNN::Dataset dataset(datasetFile);
+
+  // Split the samples into training and test sets by shuffling their indices, the data itself is not copied
+  // The shuffle is seeded, so a saved model is always evaluated on the samples it was not trained on
+  std::vector<long> indices(dataset.getSampleCount());
+  std::iota(indices.begin(), indices.end(), 0L);
+  std::shuffle(indices.begin(), indices.end(), std::mt19937(42));
+  const size_t trainSize = indices.size() * 9 / 10;
+  FlexNN::DatasetBatchSource<double> trainSet(dataset, std::vector<long>(indices.begin(), indices.begin() + trainSize)); // Training set
+  FlexNN::DatasetBatchSource<double> testSet(dataset, std::vector<long>(indices.begin() + trainSize, indices.end()));    // Test set
 
-  std::vector<std::pair<Eigen::MatrixXd, Eigen::VectorXd>> data = FlexNN::splitXY(X, Y, {0.9, 0.1}); // Split data into training and test sets
-  X = data[0].first;                                                                                 // Training set features
-  Y = data[0].second;                                                                                // Training set labels
-  Eigen::MatrixXd X_test = data[1].first;                                                            // Test set features
-  Eigen::VectorXd Y_test = data[1].second;                                                           // Test set labels
+  // Only the test set is converted up front, for the interactive predictions below
+  Eigen::MatrixXd X_test(dataset.getFeatureCount(), testSet.getSampleCount()); // Test set features, (features, samples)
+  Eigen::VectorXi Y_test(testSet.getSampleCount());                            // Test set labels
+  testSet.read(X_test, Y_test);
 
   std::cout << "Data loaded successfully." << std::endl;
-  std::cout << "Training data size: " << X.rows() << " samples, " << X.cols() << " features." << std::endl;
-  std::cout << "Test data size: " << X_test.rows() << " samples, " << X_test.cols() << " features." << std::endl;
+  std::cout << "Training data size: " << trainSet.getSampleCount() << " samples, " << trainSet.getFeatureCount() << " features." << std::endl;
+  std::cout << "Test data size: " << testSet.getSampleCount() << " samples, " << testSet.getFeatureCount() << " features." << std::endl;
+
+  // Load the network saved by an earlier run if there is one (delete the model file to train again), the weights are
+  // memory-mapped so it can predict right away. Otherwise define the neural network architecture: here we create a
+  // simple neural network with one hidden layer of 64 neurons and an output layer of 10 neurons (for digit classification)
+  const std::string modelFile = "data/mnist-model.bin";
+  const int classes = 10; // One output per digit
+  const bool trained = static_cast<bool>(std::ifstream(modelFile));
+  FlexNN::NeuralNetwork nn = trained ? FlexNN::NeuralNetwork::load(modelFile)
+                                     : FlexNN::NeuralNetwork({FlexNN::Layer(dataset.getFeatureCount(), 64, "relu"),
+                                                              FlexNN::Layer(64, classes, "softmax")});
+  if (trained)
+  {
+    // A stale or foreign model would only fail deep inside the evaluation, so check its shape against the data first
+    if (nn.getInputSize() != dataset.getFeatureCount() || nn.getOutputSize() != classes)
+    {
+      std::cerr << modelFile << " has " << nn.getInputSize() << " inputs and " << nn.getOutputSize() << " outputs, but the data has "
+                << dataset.getFeatureCount() << " features and " << classes << " classes. Delete it to train again." << std::endl;
+      return 1;
+    }
+    std::cout << "Neural Network loaded from " << modelFile << "." << std::endl;
+  }
+  else
+  {
+    std::cout << "Neural Network created with 2 layers." << std::endl;
 
-  // Transpose the matrices to match the expected input format for FlexNN
-  // FlexNN expects input in the form (features, samples), so we transpose the matrices
-  X.transposeInPlace();      // Now X is (features, samples)
-  X_test.transposeInPlace(); // Now X_test is (features, samples)
+    // Report the progress of every epoch, and check the accuracy on 1000 held-out test samples every 5 epochs
+    nn.setEpochCallback([](const FlexNN::EpochStats &stats)
+                        {
+                          std::cout << "Epoch " << stats.epoch << "/" << stats.epochs << ": Loss = " << stats.loss << ", Accuracy = " << stats.accuracy * 100 << "%";
+                          if (stats.validated)
+                            std::cout << ", Validation accuracy = " << stats.validationAccuracy * 100 << "%";
+                          std::cout << std::endl; });
+    nn.setValidation(&testSet, 5, 1000);
 
-  // Define the neural network architecture
-  // Here we create a simple neural network with one hidden layer of 64 neurons and an output layer of 10 neurons (for digit classification)
-  FlexNN::NeuralNetwork nn({FlexNN::Layer(X.rows(), 64, "relu"),
-                            FlexNN::Layer(64, 10, "softmax")});
-  std::cout << "Neural Network created with 2 layers." << std::endl;
+    // Train the neural network
+    // We use mini-batches of 256 samples, a learning rate of 0.1 and train for 20 epochs
+    std::cout << "Training started." << std::endl;
+    nn.train(trainSet, 0.1, 20, 256);
+    std::cout << "Training completed." << std::endl;
 
-  // Train the neural network
-  // We use a learning rate of 0.5 and train for 300 epochs
-  std::cout << "Training started." << std::endl;
-  nn.train(X, Y, 0.5, 300);
-  std::cout << "Training completed." << std::endl;
+    nn.save(modelFile);
+    std::cout << "Neural Network saved to " << modelFile << "." << std::endl;
+  }
 
   // Evaluate the accuracy of the neural network on both training and test sets
-  std::cout << "Accuracy on training data: " << nn.accuracy(X, Y) * 100 << "%" << std::endl;
-  std::cout << "Accuracy on testing data: " << nn.accuracy(X_test, Y_test) * 100 << "%" << std::endl;
+  std::cout << "Accuracy on training data: " << nn.accuracy(trainSet) * 100 << "%" << std::endl;
+  std::cout << "Accuracy on testing data: " << nn.accuracy(testSet) * 100 << "%" << std::endl;
 
   // Allow the user to test the model with specific indices from the test set
   int testIndex;
@@ -77,7 +124,7 @@ int main()
       continue;
     }
     // Predict the label for the given test index
-    Eigen::VectorXd prediction = nn.predict(X_test.col(testIndex));
+    Eigen::VectorXd prediction = nn.predictOne(X_test.col(testIndex));
     int predictedClass;
     prediction.maxCoeff(&predictedClass); // Get the index of the maximum value in the prediction vector
     std::cout << "Predicted Label: " << predictedClass << std::endl;
@@ -90,7 +137,7 @@ int main()
     {
       for (int j = 0; j < 28; ++j)
       {
-        double pixel = img(i * 28 + j) * 255.0; // If normalized, multiply back
+        double pixel = img(i * 28 + j) * 255.0; // Normalized, multiply back
         char c;
         if (pixel > 200)
           c = '#';
@@ -0,0 +1,350 @@
+/**
+ * @file server.cpp
+ * @brief Batching inference server for the MNIST digit recognition example using FlexNN.
+ *
+ * This file loads a saved model (or trains the same network as main.cpp and saves it, on the first run)
+ * and then serves its predictions over a Unix domain socket. The weights of a saved model are
+ * memory-mapped, so a server starts at once and several servers share one copy of them in the page
+ * cache. Requests of concurrent clients are coalesced into batches: the oldest waiting request opens a
+ * window of at most the configured latency, and when the window closes (or the batch is full) all the
+ * waiting requests run through the network in a single batched forward pass, after which every client is
+ * sent its own column of the output.
+ *
+ * Protocol, in native byte order: on connection the server sends two uint32 values, the number of
+ * features and the number of classes. Each request is then `features` float32 values, answered with
+ * `classes` float32 values (the softmax output). A connection can send any number of requests in turn.
+ *
+ * Usage: server [socket path] [max batch size] [max latency in microseconds] [training epochs] [model file]
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Dense>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Dataset.h"
+#include "FlexNN.h"
+#include "SocketIO.h"
+
+namespace
+{
+  using FlexNN::socketio::readFully;
+  using FlexNN::socketio::writeFully;
+
+  /**
+   * @brief A request waiting for its turn in a batch, owned by the thread of its connection.
+   */
+  struct Request
+  {
+    const float *input;                            ///< The features of the sample.
+    float *output;                                 ///< The buffer the output of the network is stored in.
+    std::chrono::steady_clock::time_point arrival; ///< When the request was queued, opens the batching window.
+    bool done;                                     ///< Whether the output has been stored.
+    std::condition_variable ready;                 ///< Signalled when the output has been stored.
+  };
+
+  /**
+   * @class Batcher
+   * @brief Coalesces the requests of concurrent connections into batched forward passes.
+   *
+   * The connection threads queue their requests with submit() and wait; a single batching thread takes
+   * up to `maxBatch` requests at a time, copies their features into the columns of a preallocated input
+   * matrix, runs one forward pass in a workspace it reuses, and scatters the output columns back. A batch
+   * is started as soon as it is full or when the oldest queued request has waited `maxLatency`. Since a
+   * connection only sends its next request once it has been answered, a batch is also started as soon
+   * as every open connection has a request queued, as no further request could join it.
+   *
+   * The batcher must outlive the connection threads that submit to it; the server never destroys it while
+   * connections are being served, and abandons them when the process exits.
+   */
+  class Batcher
+  {
+  public:
+    /**
+     * @brief Constructor for the Batcher class, starting the batching thread.
+     *
+     * @param nn The network to serve, which must outlive the batcher.
+     * @param features The number of inputs of the network.
+     * @param classes The number of outputs of the network.
+     * @param maxBatch The maximum number of requests in a batch.
+     * @param maxLatency The longest time a request waits for its batch to fill up.
+     */
+    Batcher(const FlexNN::NeuralNetworkF &nn, int features, int classes, int maxBatch, std::chrono::microseconds maxLatency)
+        : nn(nn), classes(classes), maxBatch(maxBatch), maxLatency(maxLatency), input(features, maxBatch), connections(0), stopping(false)
+    {
+      worker = std::thread(&Batcher::run, this);
+    }
+
+    /**
+     * @brief Destructor for the Batcher class, stopping the batching thread and waiting for it to finish.
+     *
+     * Requests still queued are not answered.
+     */
+    ~Batcher()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      arrived.notify_one();
+      worker.join();
+    }
+
+    /**
+     * @brief Count a connection that may submit requests.
+     */
+    void connect()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++connections;
+    }
+
+    /**
+     * @brief Stop counting a connection, which may complete the batch being gathered.
+     */
+    void disconnect()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        --connections;
+      }
+      arrived.notify_one();
+    }
+
+    /**
+     * @brief Queue a request and wait until its output has been stored.
+     */
+    void submit(Request &request)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      request.arrival = std::chrono::steady_clock::now();
+      request.done = false;
+      queue.push_back(&request);
+      arrived.notify_one();
+      request.ready.wait(lock, [&request]
+                         { return request.done; });
+    }
+
+  private:
+    /**
+     * @brief Body of the batching thread.
+     */
+    void run()
+    {
+      std::vector<Request *> batch;
+      batch.reserve(maxBatch);
+      FlexNN::WorkspaceF workspace;
+      for (;;)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        arrived.wait(lock, [this]
+                     { return stopping || !queue.empty(); });
+        if (stopping)
+          return;
+        arrived.wait_until(lock, queue.front()->arrival + maxLatency, [this] // The window of the oldest request
+                           { return stopping || queue.size() >= static_cast<size_t>(std::min(maxBatch, connections)); });
+        if (stopping)
+          return;
+        const size_t size = std::min(queue.size(), static_cast<size_t>(maxBatch));
+        batch.assign(queue.begin(), queue.begin() + size);
+        queue.erase(queue.begin(), queue.begin() + size);
+        lock.unlock();
+
+        // The requests are not touched by their threads until they are marked done
+        for (size_t i = 0; i < size; ++i)
+          input.col(i) = Eigen::Map<const Eigen::VectorXf>(batch[i]->input, input.rows());
+        Eigen::Ref<const Eigen::MatrixXf> output = nn.predict(input.leftCols(size), workspace); // One forward pass for the whole batch
+        for (size_t i = 0; i < size; ++i)
+          Eigen::Map<Eigen::VectorXf>(batch[i]->output, classes) = output.col(i);
+
+        lock.lock();
+        for (Request *request : batch)
+        {
+          request->done = true;
+          request->ready.notify_one(); // Under the lock, the request lives on its thread's stack and may be gone right after
+        }
+      }
+    }
+
+    const FlexNN::NeuralNetworkF &nn;           ///< The network that is served.
+    const int classes;                          ///< Number of outputs of the network.
+    const int maxBatch;                         ///< Maximum number of requests in a batch.
+    const std::chrono::microseconds maxLatency; ///< Longest wait of a request for its batch to fill up.
+    Eigen::MatrixXf input;                      ///< The features of the current batch, one column per request.
+    std::deque<Request *> queue;                ///< The requests waiting for a batch, oldest first.
+    std::mutex mutex;                           ///< Guards the queue and the done flags.
+    std::condition_variable arrived;            ///< Signalled when a request is queued or a connection closes.
+    int connections;                            ///< Number of open connections, each with at most one request queued.
+    bool stopping;                              ///< Set by the destructor to end the batching thread.
+    std::thread worker;                         ///< The batching thread.
+  };
+
+  /**
+   * @brief Serve the requests of one connection until the client disconnects.
+   */
+  void serve(int fd, Batcher &batcher, int features, int classes)
+  {
+    const uint32_t header[2] = {static_cast<uint32_t>(features), static_cast<uint32_t>(classes)};
+    std::vector<float> input(features), output(classes);
+    Request request;
+    request.input = input.data();
+    request.output = output.data();
+    batcher.connect();
+    if (writeFully(fd, header, sizeof(header)))
+    {
+      while (readFully(fd, input.data(), input.size() * sizeof(float)))
+      {
+        batcher.submit(request);
+        if (!writeFully(fd, output.data(), output.size() * sizeof(float)))
+          break;
+      }
+    }
+    batcher.disconnect();
+    close(fd);
+  }
+
+  /**
+   * @brief Number of inputs of a network for the MNIST digits, one per pixel of a 28x28 image.
+   */
+  const int imageSize = 28 * 28;
+
+  /**
+   * @brief Number of outputs of a network for the MNIST digits, one per digit.
+   */
+  const int digitClasses = 10;
+
+  /**
+   * @brief Train the network on the MNIST dataset and check it on held-out samples.
+   *
+   * The CSV file is converted to the binary dataset format on the first run, and the samples are split
+   * into training and test sets with the same seeded shuffle, like in main.cpp.
+   */
+  FlexNN::NeuralNetworkF trainModel(int epochs)
+  {
+    const std::string csvFile = "data/mnist-digit-recognition.csv";
+    const std::string datasetFile = "data/mnist-digit-recognition.bin";
+    if (!std::ifstream(datasetFile))
+    {
+      std::cout << "Reading CSV file..." << std::endl;
+      FlexNN::Dataset::fromCSV(csvFile, datasetFile, FlexNN::DataType::UInt8, 1.0 / 255.0);
+    }
+    FlexNN::Dataset dataset(datasetFile);
+
+    std::vector<long> indices(dataset.getSampleCount());
+    std::iota(indices.begin(), indices.end(), 0L);
+    std::shuffle(indices.begin(), indices.end(), std::mt19937(42));
+    const size_t trainSize = indices.size() * 9 / 10;
+    FlexNN::DatasetBatchSource<float> trainSet(dataset, std::vector<long>(indices.begin(), indices.begin() + trainSize)); // Training set
+    FlexNN::DatasetBatchSource<float> testSet(dataset, std::vector<long>(indices.begin() + trainSize, indices.end()));    // Test set
+
+    FlexNN::NeuralNetworkF nn({FlexNN::LayerF(dataset.getFeatureCount(), 64, "relu"),
+                               FlexNN::LayerF(64, digitClasses, "softmax")});
+    std::cout << "Training " << epochs << " epochs..." << std::endl;
+    nn.train(trainSet, 0.1f, epochs, 256);
+    std::cout << "Accuracy on training data: " << nn.accuracy(trainSet) * 100 << "%" << std::endl;
+    std::cout << "Accuracy on testing data: " << nn.accuracy(testSet) * 100 << "%" << std::endl;
+    return nn;
+  }
+}
+
+/**
+ * @brief Main function of the inference server.
+ *
+ * Loads the model file, or trains the network and saves it there if the file does not exist yet, then
+ * accepts connections on the Unix socket until the process is killed, serving each one on its own thread.
+ * Running out of file descriptors or memory only pauses accepting; any other accept error ends the server
+ * with std::exit(), which abandons the connection threads still being served instead of unwinding past them.
+ */
+int main(int argc, char **argv)
+{
+  const std::string socketPath = argc > 1 ? argv[1] : "/tmp/flexnn.sock";
+  const int maxBatch = argc > 2 ? std::max(1, std::atoi(argv[2])) : 64;
+  const std::chrono::microseconds maxLatency(argc > 3 ? std::atoi(argv[3]) : 1000);
+  const int epochs = argc > 4 ? std::atoi(argv[4]) : 5;
+  const std::string modelFile = argc > 5 ? argv[5] : "data/mnist-model-float.bin";
+
+  const bool trained = static_cast<bool>(std::ifstream(modelFile));
+  const FlexNN::NeuralNetworkF nn = trained ? FlexNN::NeuralNetworkF::load(modelFile) : trainModel(epochs);
+  if (trained)
+  {
+    // A stale or foreign model would serve answers of the wrong shape, so check it against the MNIST digits first
+    if (nn.getInputSize() != imageSize || nn.getOutputSize() != digitClasses)
+    {
+      std::cerr << modelFile << " has " << nn.getInputSize() << " inputs and " << nn.getOutputSize() << " outputs, but the MNIST digits need "
+                << imageSize << " and " << digitClasses << ". Delete it to train again." << std::endl;
+      return 1;
+    }
+    std::cout << "Model loaded from " << modelFile << "." << std::endl;
+  }
+  else
+  {
+    nn.save(modelFile);
+    std::cout << "Model saved to " << modelFile << "." << std::endl;
+  }
+  const int features = nn.getInputSize();
+  const int classes = nn.getOutputSize();
+
+  std::signal(SIGPIPE, SIG_IGN); // A client disconnecting mid-response ends its connection, not the server
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path))
+  {
+    std::cerr << "The socket path " << socketPath << " is too long." << std::endl;
+    return 1;
+  }
+  std::strcpy(address.sun_path, socketPath.c_str());
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0)
+  {
+    std::cerr << "Could not create socket " << socketPath << ": " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  unlink(socketPath.c_str()); // Replace the socket of an earlier run
+  if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listener, 128) < 0)
+  {
+    std::cerr << "Could not listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+    close(listener); // No connection thread exists yet, so returning is safe
+    return 1;
+  }
+
+  Batcher batcher(nn, features, classes, maxBatch, maxLatency);
+
+  std::cout << "Serving on " << socketPath << " (max batch size " << maxBatch << ", max latency " << maxLatency.count() << " us)." << std::endl;
+  for (;;)
+  {
+    const int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0)
+    {
+      const int error = errno;
+      if (error == EINTR || error == ECONNABORTED) // The next connection can be accepted right away
+        continue;
+      std::cerr << "Could not accept a connection: " << std::strerror(error) << std::endl;
+      if (error != EMFILE && error != ENFILE && error != ENOBUFS && error != ENOMEM)
+      {
+        close(listener);
+        unlink(socketPath.c_str());
+        std::exit(1); // The batcher and the network stay alive for the connection threads until the process ends
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100)); // Out of descriptors or memory, give connections time to close
+      continue;
+    }
+    std::thread(serve, fd, std::ref(batcher), features, classes).detach();
+  }
+}
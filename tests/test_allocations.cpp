@@ -0,0 +1,150 @@
+/**
+ * @file test_allocations.cpp
+ * @brief Checks that steady-state training does not allocate.
+ *
+ * Every heap allocation of the process is counted by replacing the C allocation functions (Eigen
+ * allocates with malloc, not operator new), and the count is read at the end of every epoch
+ * through the epoch callback. Once the first epoch has sized the workspaces, an epoch must not
+ * allocate at all, for small layers and for MNIST-sized ones alike: the library raises
+ * EIGEN_STACK_ALLOCATION_LIMIT so the packing blocks of its products stay on the stack. Eigen's own
+ * multithreaded GEMM shares a heap-allocated packing block between its threads, so the products are
+ * run on one thread here, as they are inside the workers of data-parallel training.
+ */
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "FlexNN.h"
+
+#if defined(__GLIBC__)
+namespace
+{
+  /**
+   * @brief Number of allocations made by the process so far.
+   */
+  std::atomic<long> allocations(0);
+}
+
+extern "C"
+{
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t count, size_t size);
+  void *__libc_realloc(void *pointer, size_t size);
+  void *__libc_memalign(size_t alignment, size_t size);
+
+  void *malloc(size_t size)
+  {
+    ++allocations;
+    return __libc_malloc(size);
+  }
+
+  void *calloc(size_t count, size_t size)
+  {
+    ++allocations;
+    return __libc_calloc(count, size);
+  }
+
+  void *realloc(void *pointer, size_t size)
+  {
+    ++allocations;
+    return __libc_realloc(pointer, size);
+  }
+
+  int posix_memalign(void **pointer, size_t alignment, size_t size)
+  {
+    ++allocations;
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer ? 0 : ENOMEM;
+  }
+
+  void *aligned_alloc(size_t alignment, size_t size)
+  {
+    ++allocations;
+    return __libc_memalign(alignment, size);
+  }
+}
+
+namespace
+{
+  /**
+   * @brief Train a two-layer network for a few epochs and check that the steady-state ones do not allocate.
+   *
+   * @param name The name of the case, for the report.
+   * @param features The number of inputs of the network.
+   * @param hidden The number of neurons of the hidden layer.
+   * @param optimizer The update rule, whose state is allocated on the first step.
+   * @return Whether the training loops over a matrix and over a BatchSource both made no allocation.
+   */
+  bool check(const std::string &name, int features, int hidden, const FlexNN::Optimizer &optimizer)
+  {
+    const int samples = 1000, classes = 10, epochs = 4, batchSize = 64;
+    Eigen::MatrixXf X = (Eigen::MatrixXf::Random(features, samples).array() + 1.0f) / 2.0f;
+    Eigen::MatrixXf Y(1, samples);
+    Eigen::VectorXf labels(samples);
+    std::vector<long> indices(samples);
+    for (int i = 0; i < samples; ++i)
+    {
+      Y(i) = labels(i) = static_cast<float>(i % classes);
+      indices[i] = i;
+    }
+    FlexNN::MatrixBatchSource<float> source(X, labels, indices, FlexNN::DataLayout::FeaturesBySamples);
+
+    FlexNN::NeuralNetworkF nn({FlexNN::LayerF(features, hidden, "relu"),
+                               FlexNN::LayerF(hidden, classes, "softmax")});
+    nn.setOptimizer(optimizer);
+    std::vector<long> perEpoch;
+    perEpoch.reserve(2 * epochs);
+    long last = 0;
+    nn.setEpochCallback([&](const FlexNN::EpochStats &)
+                        {
+                          const long now = allocations;
+                          perEpoch.push_back(now - last); // Reserved, so recording does not allocate
+                          last = now; });
+
+    bool ok = true;
+    for (int pass = 0; pass < 2; ++pass) // Over a matrix, then over a BatchSource
+    {
+      perEpoch.clear();
+      last = allocations;
+      if (pass == 0)
+        nn.train(X, Y, 0.1f, epochs, batchSize, false);
+      else
+        nn.train(source, 0.1f, epochs, batchSize, false);
+      for (size_t epoch = 1; epoch < perEpoch.size(); ++epoch) // The first epoch sizes the buffers
+      {
+        if (perEpoch[epoch] != 0)
+        {
+          std::cout << name << (pass == 0 ? " (matrix)" : " (source)") << ": epoch " << epoch + 1 << " made "
+                    << perEpoch[epoch] << " allocations" << std::endl;
+          ok = false;
+        }
+      }
+    }
+    return ok;
+  }
+}
+
+int main()
+{
+  std::srand(7);
+  Eigen::setNbThreads(1); // Serial products, see the file comment
+  bool ok = true;
+  ok &= check("small SGD", 32, 16, FlexNN::Optimizer::sgd());
+  ok &= check("small Adam", 32, 16, FlexNN::Optimizer::adam());
+  ok &= check("MNIST-sized SGD", 784, 64, FlexNN::Optimizer::sgd());
+  ok &= check("MNIST-sized Adam", 784, 64, FlexNN::Optimizer::adam());
+  std::cout << (ok ? "Steady-state training does not allocate." : "Steady-state training allocates.") << std::endl;
+  return ok ? 0 : 1;
+}
+#else
+int main()
+{
+  std::cout << "Counting allocations needs glibc, skipped." << std::endl;
+  return 77;
+}
+#endif
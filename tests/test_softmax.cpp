@@ -0,0 +1,80 @@
+/**
+ * @file test_softmax.cpp
+ * @brief Checks the softmax kernel of a layer against the reference stable softmax.
+ *
+ * The output of a softmax layer is compared with the column-wise max-subtracted softmax of its
+ * linear output, computed one column at a time with std::exp. Batches below and above the column
+ * count at which the kernel is split across threads are checked, in float and in double, with
+ * logits small enough to be exact and large enough to overflow a softmax without the max shift.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <Eigen/Dense>
+
+#include "Layer.h"
+
+namespace
+{
+  /**
+   * @brief The softmax of every column of Z, with the largest entry subtracted before exp().
+   */
+  template <typename Scalar>
+  Eigen::MatrixX<Scalar> referenceSoftmax(const Eigen::MatrixX<Scalar> &Z)
+  {
+    Eigen::MatrixX<Scalar> A(Z.rows(), Z.cols());
+    for (long j = 0; j < Z.cols(); ++j)
+    {
+      const Scalar maxCoeff = Z.col(j).maxCoeff();
+      Scalar sum = 0;
+      for (long i = 0; i < Z.rows(); ++i)
+        sum += A(i, j) = std::exp(Z(i, j) - maxCoeff);
+      A.col(j) /= sum;
+    }
+    return A;
+  }
+
+  /**
+   * @brief Compare the forward pass of a softmax layer with the reference on one batch.
+   *
+   * @param name The name of the case, for the report.
+   * @param cols The number of samples of the batch.
+   * @param logitScale The factor the inputs are multiplied by, to reach large logits.
+   * @param tolerance The largest difference allowed for any probability.
+   * @return Whether the kernel matched the reference within the tolerance.
+   */
+  template <typename Scalar>
+  bool check(const std::string &name, long cols, Scalar logitScale, Scalar tolerance)
+  {
+    const int inputs = 20, classes = 10;
+    FlexNN::BasicLayer<Scalar> layer(inputs, classes, FlexNN::Activation::Softmax);
+    const Eigen::MatrixX<Scalar> input = Eigen::MatrixX<Scalar>::Random(inputs, cols) * logitScale;
+    Eigen::MatrixX<Scalar> A(classes, cols);
+    layer.forward(input, A);
+
+    const Eigen::MatrixX<Scalar> Z = (layer.getWeights() * input).colwise() + layer.getBiases();
+    const Scalar error = (A - referenceSoftmax<Scalar>(Z)).cwiseAbs().maxCoeff();
+    const bool ok = A.allFinite() && error <= tolerance;
+    if (!ok)
+      std::cout << name << ": largest difference " << error << ", at most " << tolerance << " expected" << std::endl;
+    return ok;
+  }
+}
+
+int main()
+{
+  std::srand(7);
+  bool ok = true;
+  for (long cols : {100L, 300L}) // Serial, then split across threads (256 columns and more)
+  {
+    const std::string batch = std::to_string(cols) + " columns";
+    ok &= check<float>("float, " + batch, cols, 1.0f, 1e-6f);
+    ok &= check<double>("double, " + batch, cols, 1.0, 1e-14);
+    ok &= check<float>("float, large logits, " + batch, cols, 100.0f, 1e-6f);
+    ok &= check<double>("double, large logits, " + batch, cols, 1000.0, 1e-14);
+  }
+  std::cout << (ok ? "The softmax kernel matches the reference." : "The softmax kernel does not match the reference.") << std::endl;
+  return ok ? 0 : 1;
+}